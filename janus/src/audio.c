@@ -46,30 +46,35 @@
 
 // A number of frames per 1 channel:
 //   - https://github.com/xiph/opus/blob/7b05f44/src/opus_demo.c#L368
-#define _HZ_TO_FRAMES(_hz)	(6 * (_hz) / 50) // 120ms
-#define _HZ_TO_BUF16(_hz)	(_HZ_TO_FRAMES(_hz) * 2) // One stereo frame = (16bit L) + (16bit R)
-#define _HZ_TO_BUF8(_hz)	(_HZ_TO_BUF16(_hz) * sizeof(s16))
+#define _HZ_TO_FRAMES(_hz, _ms)	((_hz) * (_ms) / 1000)
+#define _HZ_TO_BUF16(_hz, _ms)	(_HZ_TO_FRAMES(_hz, _ms) * 2) // One stereo frame = (16bit L) + (16bit R)
+#define _HZ_TO_BUF8(_hz, _ms)	(_HZ_TO_BUF16(_hz, _ms) * sizeof(s16))
 
 #define _MIN_PCM_HZ			8000
 #define _MAX_PCM_HZ			192000
-#define _MAX_BUF16			_HZ_TO_BUF16(_MAX_PCM_HZ)
-#define _MAX_BUF8			_HZ_TO_BUF8(_MAX_PCM_HZ)
+#define _MAX_FRAME_MS		120
+#define _MAX_BUF16			_HZ_TO_BUF16(_MAX_PCM_HZ, _MAX_FRAME_MS)
+#define _MAX_BUF8			_HZ_TO_BUF8(_MAX_PCM_HZ, _MAX_FRAME_MS)
 #define _ENCODER_INPUT_HZ	48000
+#define _RINGS_MS			960 // The same queue depth as 8 * 120ms before
 
 
 typedef struct {
-	s16		data[_MAX_BUF16];
+	s16		*data;
 } _pcm_buffer_s;
 
 typedef struct {
-	u8		data[_MAX_BUF8]; // Worst case
+	u8		*data;
+	uz		allocated;
 	uz		used;
 	u64	pts;
 } _enc_buffer_s;
 
 
-static _pcm_buffer_s *_pcm_buffer_init(void);
-static _enc_buffer_s *_enc_buffer_init(void);
+static _pcm_buffer_s *_pcm_buffer_init(uz size);
+static void _pcm_buffer_destroy(_pcm_buffer_s *buf);
+static _enc_buffer_s *_enc_buffer_init(uz size);
+static void _enc_buffer_destroy(_enc_buffer_s *buf);
 
 static void *_pcm_thread(void *v_audio);
 static void *_encoder_thread(void *v_audio);
@@ -88,12 +93,26 @@ bool us_audio_probe(const char *name) {
 	return true;
 }
 
-us_audio_s *us_audio_init(const char *name, uint pcm_hz) {
+bool us_audio_is_valid_frame_ms(uint frame_ms) {
+	// Opus also supports 2.5ms and 5ms, but it's too small for PCM capture
+	switch (frame_ms) {
+		case 10:
+		case 20:
+		case 40:
+		case 60:
+		case 120: return true;
+	}
+	return false;
+}
+
+us_audio_s *us_audio_init(const char *name, uint pcm_hz, uint frame_ms, bool lowdelay, bool fec, bool dtx) {
+	assert(us_audio_is_valid_frame_ms(frame_ms));
+
 	us_audio_s *audio;
 	US_CALLOC(audio, 1);
 	audio->pcm_hz = pcm_hz;
-	US_RING_INIT_WITH_ITEMS(audio->pcm_ring, 8, _pcm_buffer_init);
-	US_RING_INIT_WITH_ITEMS(audio->enc_ring, 8, _enc_buffer_init);
+	audio->frame_ms = frame_ms;
+	audio->enc_frames = _HZ_TO_FRAMES(_ENCODER_INPUT_HZ, frame_ms);
 	atomic_init(&audio->stop, false);
 
 	int err;
@@ -123,13 +142,25 @@ us_audio_s *us_audio_init(const char *name, uint pcm_hz) {
 				audio->pcm_hz, _MIN_PCM_HZ, _MAX_PCM_HZ);
 			goto error;
 		}
-		audio->pcm_frames = _HZ_TO_FRAMES(audio->pcm_hz);
-		audio->pcm_size = _HZ_TO_BUF8(audio->pcm_hz);
+		audio->pcm_frames = _HZ_TO_FRAMES(audio->pcm_hz, frame_ms);
+		audio->pcm_size = _HZ_TO_BUF8(audio->pcm_hz, frame_ms);
 		SET_PARAM("Can't apply PCM params", snd_pcm_hw_params);
 
 #		undef SET_PARAM
 	}
 
+	{
+		// Rings are sized for the selected frame duration, not for the worst case
+		const uint capacity = _RINGS_MS / frame_ms;
+		audio->pcm_ring = us_ring_init(capacity);
+		audio->enc_ring = us_ring_init(capacity);
+		for (uz index = 0; index < capacity; ++index) {
+			audio->pcm_ring->items[index] = _pcm_buffer_init(audio->pcm_size);
+			// The encoded frame is never bigger than the PCM one
+			audio->enc_ring->items[index] = _enc_buffer_init(_HZ_TO_BUF8(_ENCODER_INPUT_HZ, frame_ms));
+		}
+	}
+
 	if (audio->pcm_hz != _ENCODER_INPUT_HZ) {
 		audio->res = speex_resampler_init(2, audio->pcm_hz, _ENCODER_INPUT_HZ, SPEEX_RESAMPLER_QUALITY_DESKTOP, &err);
 		if (err < 0) {
@@ -140,16 +171,28 @@ us_audio_s *us_audio_init(const char *name, uint pcm_hz) {
 	}
 
 	{
-		// OPUS_APPLICATION_VOIP, OPUS_APPLICATION_RESTRICTED_LOWDELAY
-		audio->enc = opus_encoder_create(_ENCODER_INPUT_HZ, 2, OPUS_APPLICATION_AUDIO, &err);
+		// RESTRICTED_LOWDELAY disables SILK and saves ~2.5ms of the lookahead,
+		// but the in-band FEC works only with SILK, so it makes no sense together.
+		audio->enc = opus_encoder_create(_ENCODER_INPUT_HZ, 2,
+			(lowdelay ? OPUS_APPLICATION_RESTRICTED_LOWDELAY : OPUS_APPLICATION_AUDIO), &err);
 		assert(err == 0);
 		assert(!opus_encoder_ctl(audio->enc, OPUS_SET_BITRATE(48000)));
 		assert(!opus_encoder_ctl(audio->enc, OPUS_SET_MAX_BANDWIDTH(OPUS_BANDWIDTH_FULLBAND)));
 		assert(!opus_encoder_ctl(audio->enc, OPUS_SET_SIGNAL(OPUS_SIGNAL_MUSIC)));
-		// OPUS_SET_INBAND_FEC(1), OPUS_SET_PACKET_LOSS_PERC(10): see rtpa.c
+		if (fec) { // See also rtpa.c
+			if (lowdelay) {
+				US_JLOG_WARN("audio", "OPUS in-band FEC has no effect in the low-delay mode");
+			}
+			assert(!opus_encoder_ctl(audio->enc, OPUS_SET_INBAND_FEC(1)));
+			assert(!opus_encoder_ctl(audio->enc, OPUS_SET_PACKET_LOSS_PERC(10)));
+		}
+		if (dtx) {
+			assert(!opus_encoder_ctl(audio->enc, OPUS_SET_DTX(1)));
+		}
 	}
 
-	US_JLOG_INFO("audio", "Pipeline configured on %uHz; capturing ...", audio->pcm_hz);
+	US_JLOG_INFO("audio", "Pipeline configured on %uHz, frame=%ums, lowdelay=%d, fec=%d, dtx=%d; capturing ...",
+		audio->pcm_hz, frame_ms, lowdelay, fec, dtx);
 	audio->tids_created = true;
 	US_THREAD_CREATE(audio->enc_tid, _encoder_thread, audio);
 	US_THREAD_CREATE(audio->pcm_tid, _pcm_thread, audio);
@@ -171,8 +214,8 @@ void us_audio_destroy(us_audio_s *audio) {
 	US_DELETE(audio->res, speex_resampler_destroy);
 	US_DELETE(audio->pcm, snd_pcm_close);
 	US_DELETE(audio->pcm_params, snd_pcm_hw_params_free);
-	US_RING_DELETE_WITH_ITEMS(audio->enc_ring, free);
-	US_RING_DELETE_WITH_ITEMS(audio->pcm_ring, free);
+	US_RING_DELETE_WITH_ITEMS(audio->enc_ring, _enc_buffer_destroy);
+	US_RING_DELETE_WITH_ITEMS(audio->pcm_ring, _pcm_buffer_destroy);
 	if (audio->tids_created) {
 		US_JLOG_INFO("audio", "Pipeline closed");
 	}
@@ -188,6 +231,10 @@ int us_audio_get_encoded(us_audio_s *audio, u8 *data, uz *size, u64 *pts) {
 		return -2;
 	}
 	const _enc_buffer_s *const buf = audio->enc_ring->items[ri];
+	if (buf->used == 0) { // Skipped by DTX or broken
+		us_ring_consumer_release(audio->enc_ring, ri);
+		return -2;
+	}
 	if (*size < buf->used) {
 		us_ring_consumer_release(audio->enc_ring, ri);
 		return -3;
@@ -199,18 +246,31 @@ int us_audio_get_encoded(us_audio_s *audio, u8 *data, uz *size, u64 *pts) {
 	return 0;
 }
 
-static _pcm_buffer_s *_pcm_buffer_init(void) {
+static _pcm_buffer_s *_pcm_buffer_init(uz size) {
 	_pcm_buffer_s *buf;
 	US_CALLOC(buf, 1);
+	US_CALLOC(buf->data, size / sizeof(s16));
 	return buf;
 }
 
-static _enc_buffer_s *_enc_buffer_init(void) {
+static void _pcm_buffer_destroy(_pcm_buffer_s *buf) {
+	free(buf->data);
+	free(buf);
+}
+
+static _enc_buffer_s *_enc_buffer_init(uz size) {
 	_enc_buffer_s *buf;
 	US_CALLOC(buf, 1);
+	US_CALLOC(buf->data, size);
+	buf->allocated = size;
 	return buf;
 }
 
+static void _enc_buffer_destroy(_enc_buffer_s *buf) {
+	free(buf->data);
+	free(buf);
+}
+
 static void *_pcm_thread(void *v_audio) {
 	US_THREAD_SETTLE("us_a_pcm");
 
@@ -258,7 +318,7 @@ static void *_encoder_thread(void *v_audio) {
 		if (audio->res != NULL) {
 			assert(audio->pcm_hz != _ENCODER_INPUT_HZ);
 			u32 in_count = audio->pcm_frames;
-			u32 out_count = _HZ_TO_FRAMES(_ENCODER_INPUT_HZ);
+			u32 out_count = audio->enc_frames;
 			speex_resampler_process_interleaved_int(audio->res, in->data, &in_count, in_res, &out_count);
 			in_ptr = in_res;
 		} else {
@@ -274,17 +334,20 @@ static void *_encoder_thread(void *v_audio) {
 		}
 		_enc_buffer_s *const out = audio->enc_ring->items[out_ri];
 
-		const int size = opus_encode(audio->enc, in_ptr, _HZ_TO_FRAMES(_ENCODER_INPUT_HZ), out->data, US_ARRAY_LEN(out->data));
+		const int size = opus_encode(audio->enc, in_ptr, audio->enc_frames, out->data, out->allocated);
 		us_ring_consumer_release(audio->pcm_ring, in_ri);
 
 		if (size >= 0) {
-			out->used = size;
+			// With DTX, the packets of 1 or 2 bytes don't need to be transmitted:
+			//   - https://opus-codec.org/docs/opus_api-1.3.1/group__opus__encoder.html
+			out->used = (size <= 2 ? 0 : size);
 			out->pts = audio->pts;
-			// https://datatracker.ietf.org/doc/html/rfc7587#section-4.2
-			audio->pts += _HZ_TO_FRAMES(_ENCODER_INPUT_HZ);
 		} else {
+			out->used = 0;
 			_JLOG_PERROR_OPUS(size, "audio", "Fatal: Can't encode PCM frame to OPUS");
 		}
+		// https://datatracker.ietf.org/doc/html/rfc7587#section-4.2
+		audio->pts += audio->enc_frames;
 		us_ring_producer_release(audio->enc_ring, out_ri);
 	}
 
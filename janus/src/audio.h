@@ -38,6 +38,8 @@ typedef struct {
 	uint				pcm_hz;
 	uint				pcm_frames;
 	uz					pcm_size;
+	uint				frame_ms;
+	uint				enc_frames;
 	snd_pcm_hw_params_t	*pcm_params;
 	SpeexResamplerState	*res;
 	OpusEncoder			*enc;
@@ -55,7 +57,9 @@ typedef struct {
 
 bool us_audio_probe(const char *name);
 
-us_audio_s *us_audio_init(const char *name, uint pcm_hz);
+bool us_audio_is_valid_frame_ms(uint frame_ms);
+
+us_audio_s *us_audio_init(const char *name, uint pcm_hz, uint frame_ms, bool lowdelay, bool fec, bool dtx);
 void us_audio_destroy(us_audio_s *audio);
 
 int us_audio_get_encoded(us_audio_s *audio, u8 *data, uz *size, u64 *pts);
@@ -52,6 +52,7 @@ us_janus_client_s *us_janus_client_init(janus_callbacks *gw, janus_plugin_sessio
 	atomic_init(&client->transmit, false);
 	atomic_init(&client->transmit_audio, false);
 	atomic_init(&client->video_orient, 0);
+	atomic_init(&client->video_stream, 0);
 
 	atomic_init(&client->stop, false);
 
@@ -79,7 +80,7 @@ void us_janus_client_destroy(us_janus_client_s *client) {
 void us_janus_client_send(us_janus_client_s *client, const us_rtp_s *rtp) {
 	if (
 		atomic_load(&client->transmit)
-		&& (rtp->video || atomic_load(&client->transmit_audio))
+		&& (rtp->video ? rtp->stream == atomic_load(&client->video_stream) : atomic_load(&client->transmit_audio))
 	) {
 		us_ring_s *const ring = (rtp->video ? client->video_ring : client->audio_ring);
 		const int ri = us_ring_producer_acquire(ring, 0);
@@ -40,6 +40,7 @@ typedef struct us_janus_client_sx {
 	atomic_bool				transmit;
 	atomic_bool				transmit_audio;
 	atomic_uint				video_orient;
+	atomic_uint				video_stream;
 
 	pthread_t				video_tid;
 	pthread_t				audio_tid;
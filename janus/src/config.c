@@ -24,18 +24,25 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <errno.h>
 
 #include <janus/config.h>
 #include <janus/plugins/plugin.h>
 
+#include "uslibs/types.h"
 #include "uslibs/tools.h"
 
 #include "const.h"
+#include "audio.h"
 #include "logging.h"
 
 
 static char *_get_value(janus_config *jcfg, const char *section, const char *option);
-// static bool _get_bool(janus_config *jcfg, const char *section, const char *option, bool def);
+static void _split_video_sinks(us_config_s *config, char *names);
+static bool _get_bool(janus_config *jcfg, const char *section, const char *option, bool def);
+static int _get_uint(janus_config *jcfg, const char *section, const char *option, uint def, uint *value);
 
 
 us_config_s *us_config_init(const char *config_dir_path) {
@@ -55,18 +62,37 @@ us_config_s *us_config_init(const char *config_dir_path) {
 	}
 	janus_config_print(jcfg);
 
-	if (
-		(config->video_sink_name = _get_value(jcfg, "memsink", "object")) == NULL
-		&& (config->video_sink_name = _get_value(jcfg, "video", "sink")) == NULL
-	) {
-		US_JLOG_ERROR("config", "Missing config value: video.sink (ex. memsink.object)");
-		goto error;
+	{
+		char *names;
+		if (
+			(names = _get_value(jcfg, "memsink", "object")) == NULL
+			&& (names = _get_value(jcfg, "video", "sink")) == NULL
+		) {
+			US_JLOG_ERROR("config", "Missing config value: video.sink (ex. memsink.object)");
+			goto error;
+		}
+		_split_video_sinks(config, names);
+		free(names);
+		if (config->n_video_sinks == 0) {
+			US_JLOG_ERROR("config", "Invalid config value: video.sink");
+			goto error;
+		}
 	}
 	if ((config->audio_dev_name = _get_value(jcfg, "audio", "device")) != NULL) {
 		if ((config->tc358743_dev_path = _get_value(jcfg, "audio", "tc358743")) == NULL) {
 			US_JLOG_INFO("config", "Missing config value: audio.tc358743");
 			goto error;
 		}
+		if (
+			_get_uint(jcfg, "audio", "frame_ms", 20, &config->audio_frame_ms) < 0
+			|| !us_audio_is_valid_frame_ms(config->audio_frame_ms)
+		) {
+			US_JLOG_ERROR("config", "Invalid config value: audio.frame_ms; should be: 10, 20, 40, 60 or 120");
+			goto error;
+		}
+		config->audio_lowdelay = _get_bool(jcfg, "audio", "lowdelay", false);
+		config->audio_fec = _get_bool(jcfg, "audio", "fec", false);
+		config->audio_dtx = _get_bool(jcfg, "audio", "dtx", false);
 	}
 
 	goto ok;
@@ -81,7 +107,10 @@ ok:
 }
 
 void us_config_destroy(us_config_s *config) {
-	US_DELETE(config->video_sink_name, free);
+	for (uint index = 0; index < config->n_video_sinks; ++index) {
+		free(config->video_sinks[index]);
+	}
+	US_DELETE(config->video_sinks, free);
 	US_DELETE(config->audio_dev_name, free);
 	US_DELETE(config->tc358743_dev_path, free);
 	free(config);
@@ -96,7 +125,17 @@ static char *_get_value(janus_config *jcfg, const char *section, const char *opt
 	return us_strdup(option_obj->value);
 }
 
-/*static bool _get_bool(janus_config *jcfg, const char *section, const char *option, bool def) {
+static void _split_video_sinks(us_config_s *config, char *names) {
+	// A comma-separated list of sinks, each one is a separate stream
+	char *saveptr = NULL;
+	for (char *name = strtok_r(names, ", \t", &saveptr); name != NULL; name = strtok_r(NULL, ", \t", &saveptr)) {
+		US_REALLOC(config->video_sinks, config->n_video_sinks + 1);
+		config->video_sinks[config->n_video_sinks] = us_strdup(name);
+		++config->n_video_sinks;
+	}
+}
+
+static bool _get_bool(janus_config *jcfg, const char *section, const char *option, bool def) {
 	char *const tmp = _get_value(jcfg, section, option);
 	bool value = def;
 	if (tmp != NULL) {
@@ -104,4 +143,22 @@ static char *_get_value(janus_config *jcfg, const char *section, const char *opt
 		free(tmp);
 	}
 	return value;
-}*/
+}
+
+static int _get_uint(janus_config *jcfg, const char *section, const char *option, uint def, uint *value) {
+	char *const tmp = _get_value(jcfg, section, option);
+	int retval = 0;
+	*value = def;
+	if (tmp != NULL) {
+		errno = 0;
+		char *end = NULL;
+		const long long parsed = strtoll(tmp, &end, 10);
+		if (errno == ERANGE || *end != '\0' || parsed < 0 || parsed > UINT_MAX) {
+			retval = -1;
+		} else {
+			*value = parsed;
+		}
+		free(tmp);
+	}
+	return retval;
+}
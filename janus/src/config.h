@@ -22,12 +22,19 @@
 
 #pragma once
 
+#include "uslibs/types.h"
+
 
 typedef struct {
-	char	*video_sink_name;
+	char	**video_sinks;
+	uint	n_video_sinks;
 
 	char	*audio_dev_name;
 	char	*tc358743_dev_path;
+	uint	audio_frame_ms;
+	bool	audio_lowdelay;
+	bool	audio_fec;
+	bool	audio_dtx;
 } us_config_s;
 
 
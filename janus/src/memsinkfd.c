@@ -58,18 +58,20 @@ int us_memsink_fd_wait_frame(int fd, us_memsink_shared_s *mem, u64 last_id) {
 }
 
 int us_memsink_fd_get_frame(int fd, us_memsink_shared_s *mem, us_frame_s *frame, u64 *frame_id, bool key_required) {
-	us_frame_set_data(frame, us_memsink_get_data(mem), mem->used);
-	US_FRAME_COPY_META(mem, frame);
-	*frame_id = mem->id;
-	mem->last_client_ts = us_get_now_monotonic();
-	if (key_required) {
-		mem->key_requested = true;
-	}
-
-	bool retval = 0;
-	if (frame->format != V4L2_PIX_FMT_H264) {
+	// The memsink is unlocked right after the copying, so the producer
+	// never waits for the packetizing and for the relaying to the clients.
+	int retval = 0;
+	if (mem->format != V4L2_PIX_FMT_H264) {
 		US_JLOG_ERROR("video", "Got non-H264 frame from memsink");
 		retval = -1;
+	} else {
+		us_frame_set_data(frame, us_memsink_get_data(mem), mem->used);
+		US_FRAME_COPY_META(mem, frame);
+		*frame_id = mem->id;
+		mem->last_client_ts = us_get_now_monotonic();
+		if (key_required) {
+			mem->key_requested = true;
+		}
 	}
 	if (flock(fd, LOCK_UN) < 0) {
 		US_JLOG_PERROR("video", "Can't unlock memsink");
@@ -39,8 +39,9 @@
 #include "uslibs/const.h"
 #include "uslibs/tools.h"
 #include "uslibs/threading.h"
+#include "uslibs/array.h"
 #include "uslibs/list.h"
-#include "uslibs/ring.h"
+#include "uslibs/frame.h"
 #include "uslibs/memsinksh.h"
 #include "uslibs/tc358743.h"
 
@@ -57,37 +58,51 @@
 
 static us_config_s		*_g_config = NULL;
 static const useconds_t	_g_watchers_polling = 100000;
+static const ldf		_g_tc358743_polling = 0.5;
+
+// The clients list is changed only under _g_clients_lock. The RTP threads
+// don't touch it and read an immutable snapshot without locks instead.
+// An old snapshot is freed (and a removed client is destroyed) only after
+// all the readers have left it, see _clients_publish().
+typedef struct {
+	us_janus_client_s	**items;
+	uint				count;
+} _clients_snapshot_s;
+
+// Each configured video sink is a separate stream with its own reader,
+// packetizer and watchers. Clients select it by the index in "watch".
+typedef struct {
+	uint		id;
+	const char	*sink_name;
+	us_rtpv_s	*rtpv;
+
+	pthread_t	tid;
+	atomic_bool	tid_created;
+	atomic_bool	has_watchers;
+	atomic_bool	key_required;
+} _stream_s;
 
 static us_janus_client_s	*_g_clients = NULL;
+static _clients_snapshot_s	*_Atomic _g_clients_snapshot = NULL;
+static atomic_ullong		_g_clients_gen = 1;
+static atomic_ullong		*_g_clients_readers = NULL; // Audio + streams, 0 == not reading
 static janus_callbacks		*_g_gw = NULL;
-static us_ring_s			*_g_video_ring = NULL;
-static us_rtpv_s			*_g_rtpv = NULL;
+static _stream_s			*_g_streams = NULL;
+static uint					_g_n_streams = 0;
 static us_rtpa_s			*_g_rtpa = NULL;
 
-static pthread_t		_g_video_rtp_tid;
-static atomic_bool		_g_video_rtp_tid_created = false;
-static pthread_t		_g_video_sink_tid;
-static atomic_bool		_g_video_sink_tid_created = false;
 static pthread_t		_g_audio_tid;
 static atomic_bool		_g_audio_tid_created = false;
 
-static pthread_mutex_t	_g_video_lock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t	_g_audio_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t	_g_clients_lock = PTHREAD_MUTEX_INITIALIZER;
 static atomic_bool		_g_ready = false;
 static atomic_bool		_g_stop = false;
 static atomic_bool		_g_has_watchers = false;
 static atomic_bool		_g_has_listeners = false;
-static atomic_bool		_g_key_required = false;
 
 
-#define _LOCK_VIDEO		US_MUTEX_LOCK(_g_video_lock)
-#define _UNLOCK_VIDEO	US_MUTEX_UNLOCK(_g_video_lock)
-
-#define _LOCK_AUDIO		US_MUTEX_LOCK(_g_audio_lock)
-#define _UNLOCK_AUDIO	US_MUTEX_UNLOCK(_g_audio_lock)
-
-#define _LOCK_ALL		{ _LOCK_VIDEO; _LOCK_AUDIO; }
-#define _UNLOCK_ALL		{ _UNLOCK_AUDIO; _UNLOCK_VIDEO; }
+#define _LOCK_CLIENTS	US_MUTEX_LOCK(_g_clients_lock)
+#define _UNLOCK_CLIENTS	US_MUTEX_UNLOCK(_g_clients_lock)
 
 #define _READY			atomic_load(&_g_ready)
 #define _STOP			atomic_load(&_g_stop)
@@ -98,37 +113,72 @@ static atomic_bool		_g_key_required = false;
 janus_plugin *create(void);
 
 
-static void *_video_rtp_thread(void *arg) {
-	(void)arg;
-	US_THREAD_SETTLE("us_video_rtp");
-	atomic_store(&_g_video_rtp_tid_created, true);
+static void _clients_publish(void) {
+	// Must be called under _LOCK_CLIENTS
+	_clients_snapshot_s *snapshot;
+	US_CALLOC(snapshot, 1);
+	US_LIST_ITERATE(_g_clients, client, { ++snapshot->count; });
+	if (snapshot->count > 0) {
+		US_CALLOC(snapshot->items, snapshot->count);
+		uint index = 0;
+		US_LIST_ITERATE(_g_clients, client, { snapshot->items[index++] = client; });
+	}
 
-	while (!_STOP) {
-		const int ri = us_ring_consumer_acquire(_g_video_ring, 0.1);
-		if (ri >= 0) {
-			const us_frame_s *const frame = _g_video_ring->items[ri];
-			_LOCK_VIDEO;
-			const bool zero_playout_delay = (frame->gop == 0);
-			us_rtpv_wrap(_g_rtpv, frame, zero_playout_delay);
-			_UNLOCK_VIDEO;
-			us_ring_consumer_release(_g_video_ring, ri);
+	_clients_snapshot_s *const old = atomic_exchange(&_g_clients_snapshot, snapshot);
+	const u64 gen = atomic_fetch_add(&_g_clients_gen, 1) + 1;
+
+	// Wait for the readers which could get the old snapshot.
+	// Relaying of a single packet is very short and never blocks.
+	for (uint index = 0; index < _g_n_streams + 1; ++index) {
+		u64 reader_gen;
+		while ((reader_gen = atomic_load(&_g_clients_readers[index])) != 0 && reader_gen < gen) {
+			usleep(100);
 		}
 	}
-	return NULL;
+
+	if (old != NULL) {
+		free(old->items);
+		free(old);
+	}
 }
 
-static void *_video_sink_thread(void *arg) {
-	(void)arg;
+static void _refresh_watchers(void) {
+	// Must be called under _LOCK_CLIENTS
+	bool has_watchers = false;
+	bool has_listeners = false;
+	for (uint index = 0; index < _g_n_streams; ++index) {
+		_stream_s *const stream = &_g_streams[index];
+		bool has_stream_watchers = false;
+		US_LIST_ITERATE(_g_clients, client, {
+			if (atomic_load(&client->transmit) && atomic_load(&client->video_stream) == stream->id) {
+				has_stream_watchers = true;
+				break;
+			}
+		});
+		atomic_store(&stream->has_watchers, has_stream_watchers);
+	}
+	US_LIST_ITERATE(_g_clients, client, {
+		has_watchers = (has_watchers || atomic_load(&client->transmit));
+		has_listeners = (has_listeners || atomic_load(&client->transmit_audio));
+	});
+	atomic_store(&_g_has_watchers, has_watchers);
+	atomic_store(&_g_has_listeners, has_listeners);
+}
+
+
+static void *_video_sink_thread(void *v_stream) {
 	US_THREAD_SETTLE("us_video_sink");
-	atomic_store(&_g_video_sink_tid_created, true);
+	_stream_s *const stream = v_stream;
+	atomic_store(&stream->tid_created, true);
 
-	us_frame_s *drop = us_frame_init();
+	// A single frame is reused, it grows to the biggest one and is not reallocated then
+	us_frame_s *frame = us_frame_init();
 	u64 frame_id = 0;
 	int once = 0;
 
 	while (!_STOP) {
-		if (!_HAS_WATCHERS) {
-			US_ONCE({ US_JLOG_INFO("video", "No active watchers, memsink disconnected"); });
+		if (!atomic_load(&stream->has_watchers)) {
+			US_ONCE({ US_JLOG_INFO("video", "Stream %u: No active watchers, memsink disconnected", stream->id); });
 			usleep(_g_watchers_polling);
 			continue;
 		}
@@ -136,47 +186,35 @@ static void *_video_sink_thread(void *arg) {
 		int fd = -1;
 		us_memsink_shared_s *mem = NULL;
 
-		const uz data_size = us_memsink_calculate_size(_g_config->video_sink_name);
+		const uz data_size = us_memsink_calculate_size(stream->sink_name);
 		if (data_size == 0) {
-			US_ONCE({ US_JLOG_ERROR("video", "Invalid memsink object suffix"); });
+			US_ONCE({ US_JLOG_ERROR("video", "Stream %u: Invalid memsink object suffix", stream->id); });
 			goto close_memsink;
 		}
 
-		if ((fd = shm_open(_g_config->video_sink_name, O_RDWR, 0)) <= 0) {
-			US_ONCE({ US_JLOG_PERROR("video", "Can't open memsink"); });
+		if ((fd = shm_open(stream->sink_name, O_RDWR, 0)) <= 0) {
+			US_ONCE({ US_JLOG_PERROR("video", "Stream %u: Can't open memsink", stream->id); });
 			goto close_memsink;
 		}
 
 		if ((mem = us_memsink_shared_map(fd, data_size)) == NULL) {
-			US_ONCE({ US_JLOG_PERROR("video", "Can't map memsink"); });
+			US_ONCE({ US_JLOG_PERROR("video", "Stream %u: Can't map memsink", stream->id); });
 			goto close_memsink;
 		}
 
 		once = 0;
 
-		US_JLOG_INFO("video", "Memsink opened; reading frames ...");
-		while (!_STOP && _HAS_WATCHERS) {
+		US_JLOG_INFO("video", "Stream %u: Memsink opened; reading frames ...", stream->id);
+		while (!_STOP && atomic_load(&stream->has_watchers)) {
 			const int waited = us_memsink_fd_wait_frame(fd, mem, frame_id);
 			if (waited == 0) {
-				const int ri = us_ring_producer_acquire(_g_video_ring, 0);
-				us_frame_s *frame;
-				if (ri >= 0) {
-					frame = _g_video_ring->items[ri];
-				} else {
-					US_ONCE({ US_JLOG_PERROR("video", "Video ring is full"); });
-					frame = drop;
-				}
-
-				const int got = us_memsink_fd_get_frame(fd, mem, frame, &frame_id, atomic_load(&_g_key_required));
-				if (ri >= 0) {
-					us_ring_producer_release(_g_video_ring, ri);
-				}
-				if (got < 0) {
+				if (us_memsink_fd_get_frame(fd, mem, frame, &frame_id, atomic_load(&stream->key_required)) < 0) {
 					goto close_memsink;
 				}
-
-				if (ri >= 0 && frame->key) {
-					atomic_store(&_g_key_required, false);
+				const bool zero_playout_delay = (frame->gop == 0);
+				us_rtpv_wrap(stream->rtpv, frame, zero_playout_delay);
+				if (frame->key) {
+					atomic_store(&stream->key_required, false);
 				}
 			} else if (waited != -2) {
 				goto close_memsink;
@@ -189,27 +227,26 @@ static void *_video_sink_thread(void *arg) {
 			mem = NULL;
 		}
 		US_CLOSE_FD(fd);
-		US_JLOG_INFO("video", "Memsink closed");
+		US_JLOG_INFO("video", "Stream %u: Memsink closed", stream->id);
 		sleep(1); // error_delay
 	}
-
-	us_frame_destroy(drop);
+	us_frame_destroy(frame);
 	return NULL;
 }
 
-static int _check_tc358743_audio(uint *audio_hz) {
-	int fd;
-	if ((fd = open(_g_config->tc358743_dev_path, O_RDWR)) < 0) {
+static int _check_tc358743_audio(int *fd, uint *audio_hz) {
+	// The device is kept open between the checks, so the audio thread
+	// doesn't open() and close() it on each encoded packet.
+	if (*fd < 0 && (*fd = open(_g_config->tc358743_dev_path, O_RDWR)) < 0) {
 		US_JLOG_PERROR("audio", "Can't open TC358743 V4L2 device");
 		return -1;
 	}
-	const int checked = us_tc358743_xioctl_get_audio_hz(fd, audio_hz);
+	const int checked = us_tc358743_xioctl_get_audio_hz(*fd, audio_hz);
 	if (checked < 0) {
 		US_JLOG_PERROR("audio", "Can't check TC358743 audio state (%d)", checked);
-		close(fd);
+		US_CLOSE_FD(*fd);
 		return -1;
 	}
-	close(fd);
 	return 0;
 }
 
@@ -222,9 +259,11 @@ static void *_audio_thread(void *arg) {
 	assert(_g_config->tc358743_dev_path != NULL);
 
 	int once = 0;
+	int tc358743_fd = -1;
 
 	while (!_STOP) {
 		if (!_HAS_WATCHERS || !_HAS_LISTENERS) {
+			US_CLOSE_FD(tc358743_fd);
 			usleep(_g_watchers_polling);
 			continue;
 		}
@@ -232,7 +271,7 @@ static void *_audio_thread(void *arg) {
 		uint audio_hz = 0;
 		us_audio_s *audio = NULL;
 
-		if (_check_tc358743_audio(&audio_hz) < 0) {
+		if (_check_tc358743_audio(&tc358743_fd, &audio_hz) < 0) {
 			goto close_audio;
 		}
 		if (audio_hz == 0) {
@@ -240,24 +279,30 @@ static void *_audio_thread(void *arg) {
 			goto close_audio;
 		}
 		US_ONCE({ US_JLOG_INFO("audio", "Detected host audio"); });
-		if ((audio = us_audio_init(_g_config->audio_dev_name, audio_hz)) == NULL) {
+		if ((audio = us_audio_init(
+			_g_config->audio_dev_name, audio_hz, _g_config->audio_frame_ms,
+			_g_config->audio_lowdelay, _g_config->audio_fec, _g_config->audio_dtx
+		)) == NULL) {
 			goto close_audio;
 		}
 
 		once = 0;
 
+		ldf next_check_ts = us_get_now_monotonic() + _g_tc358743_polling;
 		while (!_STOP && _HAS_WATCHERS && _HAS_LISTENERS) {
-			if (_check_tc358743_audio(&audio_hz) < 0 || audio->pcm_hz != audio_hz) {
-				goto close_audio;
+			const ldf now_ts = us_get_now_monotonic();
+			if (now_ts >= next_check_ts) {
+				if (_check_tc358743_audio(&tc358743_fd, &audio_hz) < 0 || audio->pcm_hz != audio_hz) {
+					goto close_audio;
+				}
+				next_check_ts = now_ts + _g_tc358743_polling;
 			}
 			uz size = US_RTP_DATAGRAM_SIZE - US_RTP_HEADER_SIZE;
 			u8 data[size];
 			u64 pts;
 			const int result = us_audio_get_encoded(audio, data, &size, &pts);
 			if (result == 0) {
-				_LOCK_AUDIO;
 				us_rtpa_wrap(_g_rtpa, data, size, pts);
-				_UNLOCK_AUDIO;
 			} else if (result == -1) {
 				goto close_audio;
 			}
@@ -267,13 +312,22 @@ static void *_audio_thread(void *arg) {
 		US_DELETE(audio, us_audio_destroy);
 		sleep(1); // error_delay
 	}
+	US_CLOSE_FD(tc358743_fd);
 	return NULL;
 }
 
 static void _relay_rtp_clients(const us_rtp_s *rtp) {
-	US_LIST_ITERATE(_g_clients, client, {
-		us_janus_client_send(client, rtp);
-	});
+	// Called only from the video sink threads or from the audio thread,
+	// so each of them has its own reader slot.
+	atomic_ullong *const reader = &_g_clients_readers[rtp->video ? rtp->stream + 1 : 0];
+	atomic_store(reader, atomic_load(&_g_clients_gen));
+	const _clients_snapshot_s *const snapshot = atomic_load(&_g_clients_snapshot);
+	if (snapshot != NULL) {
+		for (uint index = 0; index < snapshot->count; ++index) {
+			us_janus_client_send(snapshot->items[index], rtp);
+		}
+	}
+	atomic_store(reader, 0);
 }
 
 static int _plugin_init(janus_callbacks *gw, const char *config_dir_path) {
@@ -289,14 +343,24 @@ static int _plugin_init(janus_callbacks *gw, const char *config_dir_path) {
 	}
 	_g_gw = gw;
 
-	US_RING_INIT_WITH_ITEMS(_g_video_ring, 64, us_frame_init);
-	_g_rtpv = us_rtpv_init(_relay_rtp_clients);
+	_g_n_streams = _g_config->n_video_sinks;
+	US_CALLOC(_g_streams, _g_n_streams);
+	US_CALLOC(_g_clients_readers, _g_n_streams + 1);
+	for (uint index = 0; index < _g_n_streams; ++index) {
+		_stream_s *const stream = &_g_streams[index];
+		stream->id = index;
+		stream->sink_name = _g_config->video_sinks[index];
+		stream->rtpv = us_rtpv_init(_relay_rtp_clients, index);
+		US_JLOG_INFO("main", "Stream %u: %s", index, stream->sink_name);
+	}
+
 	if (_g_config->audio_dev_name != NULL && us_audio_probe(_g_config->audio_dev_name)) {
-		_g_rtpa = us_rtpa_init(_relay_rtp_clients);
+		_g_rtpa = us_rtpa_init(_relay_rtp_clients, _g_config->audio_frame_ms, _g_config->audio_fec, _g_config->audio_dtx);
 		US_THREAD_CREATE(_g_audio_tid, _audio_thread, NULL);
 	}
-	US_THREAD_CREATE(_g_video_rtp_tid, _video_rtp_thread, NULL);
-	US_THREAD_CREATE(_g_video_sink_tid, _video_sink_thread, NULL);
+	for (uint index = 0; index < _g_n_streams; ++index) {
+		US_THREAD_CREATE(_g_streams[index].tid, _video_sink_thread, &_g_streams[index]);
+	}
 
 	atomic_store(&_g_ready, true);
 	return 0;
@@ -307,8 +371,9 @@ static void _plugin_destroy(void) {
 
 	atomic_store(&_g_stop, true);
 #	define JOIN(_tid) { if (atomic_load(&_tid##_created)) { US_THREAD_JOIN(_tid); } }
-	JOIN(_g_video_sink_tid);
-	JOIN(_g_video_rtp_tid);
+	for (uint index = 0; index < _g_n_streams; ++index) {
+		JOIN(_g_streams[index].tid);
+	}
 	JOIN(_g_audio_tid);
 #	undef JOIN
 
@@ -316,11 +381,19 @@ static void _plugin_destroy(void) {
 		US_LIST_REMOVE(_g_clients, client);
 		us_janus_client_destroy(client);
 	});
-
-	US_RING_DELETE_WITH_ITEMS(_g_video_ring, us_frame_destroy);
+	_clients_snapshot_s *const snapshot = atomic_exchange(&_g_clients_snapshot, NULL);
+	if (snapshot != NULL) {
+		free(snapshot->items);
+		free(snapshot);
+	}
 
 	US_DELETE(_g_rtpa, us_rtpa_destroy);
-	US_DELETE(_g_rtpv, us_rtpv_destroy);
+	for (uint index = 0; index < _g_n_streams; ++index) {
+		US_DELETE(_g_streams[index].rtpv, us_rtpv_destroy);
+	}
+	US_DELETE(_g_streams, free);
+	US_DELETE(_g_clients_readers, free);
+	_g_n_streams = 0;
 	US_DELETE(_g_config, us_config_destroy);
 }
 
@@ -328,77 +401,86 @@ static void _plugin_destroy(void) {
 
 static void _plugin_create_session(janus_plugin_session *session, int *err) {
 	_IF_DISABLED({ *err = -1; return; });
-	_LOCK_ALL;
+	_LOCK_CLIENTS;
 	US_JLOG_INFO("main", "Creating session %p ...", session);
 	us_janus_client_s *const client = us_janus_client_init(_g_gw, session);
 	US_LIST_APPEND(_g_clients, client);
+	_clients_publish();
+	_refresh_watchers();
+	// Connect to the default stream in advance, before the media setup
+	atomic_store(&_g_streams[0].has_watchers, true);
 	atomic_store(&_g_has_watchers, true);
-	_UNLOCK_ALL;
+	_UNLOCK_CLIENTS;
 }
 
 static void _plugin_destroy_session(janus_plugin_session* session, int *err) {
 	_IF_DISABLED({ *err = -1; return; });
-	_LOCK_ALL;
-	bool found = false;
-	bool has_watchers = false;
-	bool has_listeners = false;
+	_LOCK_CLIENTS;
+	us_janus_client_s *found = NULL;
 	US_LIST_ITERATE(_g_clients, client, {
 		if (client->session == session) {
 			US_JLOG_INFO("main", "Removing session %p ...", session);
 			US_LIST_REMOVE(_g_clients, client);
-			us_janus_client_destroy(client);
-			found = true;
-		} else {
-			has_watchers = (has_watchers || atomic_load(&client->transmit));
-			has_listeners = (has_listeners || atomic_load(&client->transmit_audio));
+			found = client;
 		}
 	});
-	if (!found) {
+	if (found != NULL) {
+		_clients_publish(); // After that the client is not used by RTP threads
+		us_janus_client_destroy(found);
+	} else {
 		US_JLOG_WARN("main", "No session %p", session);
 		*err = -2;
 	}
-	atomic_store(&_g_has_watchers, has_watchers);
-	atomic_store(&_g_has_listeners, has_listeners);
-	_UNLOCK_ALL;
+	_refresh_watchers();
+	_UNLOCK_CLIENTS;
 }
 
 static json_t *_plugin_query_session(janus_plugin_session *session) {
 	_IF_DISABLED({ return NULL; });
 	json_t *info = NULL;
-	_LOCK_ALL;
+	_LOCK_CLIENTS;
 	US_LIST_ITERATE(_g_clients, client, {
 		if (client->session == session) {
 			info = json_string("session_found");
 			break;
 		}
 	});
-	_UNLOCK_ALL;
+	_UNLOCK_CLIENTS;
 	return info;
 }
 
 static void _set_transmit(janus_plugin_session *session, const char *msg, bool transmit) {
 	(void)msg;
 	_IF_DISABLED({ return; });
-	_LOCK_ALL;
+	_LOCK_CLIENTS;
 	bool found = false;
-	bool has_watchers = false;
 	US_LIST_ITERATE(_g_clients, client, {
 		if (client->session == session) {
 			atomic_store(&client->transmit, transmit);
 			// US_JLOG_INFO("main", "%s session %p", msg, session);
 			found = true;
 		}
-		has_watchers = (has_watchers || atomic_load(&client->transmit));
 	});
 	if (!found) {
 		US_JLOG_WARN("main", "No session %p", session);
 	}
-	atomic_store(&_g_has_watchers, has_watchers);
-	_UNLOCK_ALL;
+	_refresh_watchers();
+	_UNLOCK_CLIENTS;
 }
 
 #undef _IF_DISABLED
 
+static void _request_key(janus_plugin_session *session) {
+	_LOCK_CLIENTS;
+	US_LIST_ITERATE(_g_clients, client, {
+		if (client->session == session) {
+			atomic_store(&_g_streams[atomic_load(&client->video_stream)].key_required, true);
+			break;
+		}
+	});
+	_UNLOCK_CLIENTS;
+}
+
 static void _plugin_setup_media(janus_plugin_session *session) { _set_transmit(session, "Unmuted", true); }
 static void _plugin_hangup_media(janus_plugin_session *session) { _set_transmit(session, "Muted", false); }
 
@@ -463,9 +545,21 @@ static struct janus_plugin_result *_plugin_handle_message(
 	} else if (!strcmp(request_str, "watch")) {
 		bool with_audio = false;
 		uint video_orient = 0;
+		uint video_stream = 0;
 		{
 			json_t *const params = json_object_get(msg, "params");
 			if (params != NULL) {
+				{
+					json_t *const obj = json_object_get(params, "stream");
+					if (obj != NULL && json_is_integer(obj)) {
+						const json_int_t id = json_integer_value(obj);
+						if (id < 0 || id >= _g_n_streams) {
+							PUSH_ERROR(400, "Invalid stream");
+							goto ok_wait;
+						}
+						video_stream = id;
+					}
+				}
 				{
 					json_t *const obj = json_object_get(params, "audio");
 					if (obj != NULL && json_is_boolean(obj)) {
@@ -487,7 +581,7 @@ static struct janus_plugin_result *_plugin_handle_message(
 
 		{
 			char *sdp;
-			char *const video_sdp = us_rtpv_make_sdp(_g_rtpv);
+			char *const video_sdp = us_rtpv_make_sdp(_g_streams[video_stream].rtpv);
 			char *const audio_sdp = (with_audio ? us_rtpa_make_sdp(_g_rtpa) : us_strdup(""));
 			US_ASPRINTF(sdp,
 				"v=0" RN
@@ -515,27 +609,27 @@ static struct janus_plugin_result *_plugin_handle_message(
 		}
 
 		{
-			_LOCK_ALL;
-			bool has_listeners = false;
+			_LOCK_CLIENTS;
 			US_LIST_ITERATE(_g_clients, client, {
 				if (client->session == session) {
 					atomic_store(&client->transmit_audio, with_audio);
 					atomic_store(&client->video_orient, video_orient);
+					atomic_store(&client->video_stream, video_stream);
 				}
-				has_listeners = (has_listeners || atomic_load(&client->transmit_audio));
 			});
-			atomic_store(&_g_has_listeners, has_listeners);
-			_UNLOCK_ALL;
+			_refresh_watchers();
+			atomic_store(&_g_streams[video_stream].key_required, true);
+			_UNLOCK_CLIENTS;
 		}
 
 	} else if (!strcmp(request_str, "features")) {
-		json_t *const features = json_pack("{sb}", "audio", (_g_rtpa != NULL));
+		json_t *const features = json_pack("{sbsi}", "audio", (_g_rtpa != NULL), "streams", _g_n_streams);
 		PUSH_STATUS("features", features, NULL);
 		json_decref(features);
 
 	} else if (!strcmp(request_str, "key_required")) {
 		// US_JLOG_INFO("main", "Got key_required message");
-		atomic_store(&_g_key_required, true);
+		_request_key(session);
 
 	} else {
 		PUSH_ERROR(405, "Not implemented");
@@ -551,11 +645,9 @@ ok_wait:
 }
 
 static void _plugin_incoming_rtcp(janus_plugin_session *handle, janus_plugin_rtcp *packet) {
-	(void)handle;
-	(void)packet;
 	if (packet->video && janus_rtcp_has_pli(packet->buffer, packet->length)) {
 		// US_JLOG_INFO("main", "Got video PLI");
-		atomic_store(&_g_key_required, true);
+		_request_key(handle);
 	}
 }
 
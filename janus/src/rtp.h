@@ -33,6 +33,7 @@
 typedef struct {
 	uint	payload;
 	bool	video;
+	uint	stream; // Video stream index
 	u32		ssrc;
 
 	u16		seq;
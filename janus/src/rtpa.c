@@ -29,12 +29,15 @@
 #include "uslibs/tools.h"
 
 
-us_rtpa_s *us_rtpa_init(us_rtp_callback_f callback) {
+us_rtpa_s *us_rtpa_init(us_rtp_callback_f callback, uint frame_ms, bool fec, bool dtx) {
 	us_rtpa_s *rtpa;
 	US_CALLOC(rtpa, 1);
 	rtpa->rtp = us_rtp_init();
 	us_rtp_assign(rtpa->rtp, 111, false);
 	rtpa->callback = callback;
+	rtpa->frame_ms = frame_ms;
+	rtpa->fec = fec;
+	rtpa->dtx = dtx;
 	return rtpa;
 }
 
@@ -50,13 +53,14 @@ char *us_rtpa_make_sdp(us_rtpa_s *rtpa) {
 		"m=audio 1 RTP/SAVPF %u" RN
 		"c=IN IP4 0.0.0.0" RN
 		"a=rtpmap:%u OPUS/48000/2" RN
-		// "a=fmtp:%u useinbandfec=1" RN
+		"a=fmtp:%u useinbandfec=%d;usedtx=%d" RN
+		"a=ptime:%u" RN
 		"a=rtcp-fb:%u nack" RN
 		"a=rtcp-fb:%u nack pli" RN
 		"a=rtcp-fb:%u goog-remb" RN
 		"a=ssrc:%" PRIu32 " cname:ustreamer" RN
 		"a=sendonly" RN,
-		pl, pl, pl, pl, pl, // pl,
+		pl, pl, pl, rtpa->fec, rtpa->dtx, rtpa->frame_ms, pl, pl, pl,
 		rtpa->rtp->ssrc
 	);
 	return sdp;
@@ -30,10 +30,13 @@
 typedef struct {
 	us_rtp_s			*rtp;
 	us_rtp_callback_f	callback;
+	uint				frame_ms;
+	bool				fec;
+	bool				dtx;
 } us_rtpa_s;
 
 
-us_rtpa_s *us_rtpa_init(us_rtp_callback_f callback);
+us_rtpa_s *us_rtpa_init(us_rtp_callback_f callback, uint frame_ms, bool fec, bool dtx);
 void us_rtpa_destroy(us_rtpa_s *rtpa);
 
 char *us_rtpa_make_sdp(us_rtpa_s *rtpa);
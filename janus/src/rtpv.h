@@ -34,7 +34,7 @@ typedef struct {
 } us_rtpv_s;
 
 
-us_rtpv_s *us_rtpv_init(us_rtp_callback_f callback);
+us_rtpv_s *us_rtpv_init(us_rtp_callback_f callback, uint stream);
 void us_rtpv_destroy(us_rtpv_s *rtpv);
 
 char *us_rtpv_make_sdp(us_rtpv_s *rtpv);
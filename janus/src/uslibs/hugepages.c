@@ -0,0 +1 @@
+../../../src/libs/hugepages.c
\ No newline at end of file
@@ -0,0 +1 @@
+../../../src/libs/hugepages.h
\ No newline at end of file
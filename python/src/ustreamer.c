@@ -239,6 +239,9 @@ static PyObject *_MemsinkObject_wait_frame(_MemsinkObject *self, PyObject *args,
 	SET_NUMBER(grab_ts, Double, Float);
 	SET_NUMBER(encode_begin_ts, Double, Float);
 	SET_NUMBER(encode_end_ts, Double, Float);
+	SET_NUMBER(change_mapped, Long, Bool);
+	SET_NUMBER(changed_tiles, Long, Long);
+	SET_VALUE("change_map", PyBytes_FromStringAndSize((const char*)self->frame->change_map, US_FRAME_CHANGE_MAP_SIZE));
 	SET_VALUE("data", PyBytes_FromStringAndSize((const char*)self->frame->data, self->frame->used));
 
 #	undef SET_NUMBER
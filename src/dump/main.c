@@ -276,7 +276,9 @@ static int _dump_sink(
 				usleep(interval_us);
 			}
 		} else if (error == -2) {
-			usleep(1000);
+			if (us_memsink_client_wait(sink) < 0) {
+				goto error;
+			}
 		} else {
 			goto error;
 		}
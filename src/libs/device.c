@@ -39,6 +39,8 @@
 #include <pthread.h>
 #include <linux/videodev2.h>
 #include <linux/v4l2-controls.h>
+#include <linux/dma-heap.h>
+#include <linux/dma-buf.h>
 
 #include "types.h"
 #include "tools.h"
@@ -47,6 +49,8 @@
 #include "threading.h"
 #include "frame.h"
 #include "xioctl.h"
+#include "hugepages.h"
+#include "jpegcheck.h"
 
 
 static const struct {
@@ -69,6 +73,10 @@ static const struct {
 	{"RGB565",	V4L2_PIX_FMT_RGB565},
 	{"RGB24",	V4L2_PIX_FMT_RGB24},
 	{"BGR24",	V4L2_PIX_FMT_BGR24},
+	{"NV12",	V4L2_PIX_FMT_NV12},
+	{"NV16",	V4L2_PIX_FMT_NV16},
+	{"YUV420",	V4L2_PIX_FMT_YUV420},
+	{"GREY",	V4L2_PIX_FMT_GREY},
 	{"MJPEG",	V4L2_PIX_FMT_MJPEG},
 	{"JPEG",	V4L2_PIX_FMT_JPEG},
 };
@@ -79,8 +87,15 @@ static const struct {
 } _IO_METHODS[] = {
 	{"MMAP",	V4L2_MEMORY_MMAP},
 	{"USERPTR",	V4L2_MEMORY_USERPTR},
+	{"DMABUF",	V4L2_MEMORY_DMABUF},
 };
 
+// For --buffers=auto
+#define _AUTO_BUFS_MIN_SAMPLES	((uint)100)
+#define _AUTO_BUFS_MAX_STARVED	((uint)10)
+#define _AUTO_BUFS_STARVED_WINDOW	((ldf)10) // Seconds for _AUTO_BUFS_MAX_STARVED
+
+
 static int _device_wait_buffer(us_device_s *dev);
 static int _device_consume_event(us_device_s *dev);
 static void _v4l2_buffer_copy(const struct v4l2_buffer *src, struct v4l2_buffer *dest);
@@ -93,8 +108,14 @@ static void _device_open_jpeg_quality(us_device_s *dev);
 static int _device_open_io_method(us_device_s *dev);
 static int _device_open_io_method_mmap(us_device_s *dev);
 static int _device_open_io_method_userptr(us_device_s *dev);
+static int _device_open_io_method_dmabuf(us_device_s *dev);
+static int _device_alloc_heap_buffers(us_device_s *dev, uint n_bufs, uz size);
+static void _device_free_heap_buffers(us_device_s *dev);
+static void _device_sync_dma(us_device_s *dev, uint index, bool start);
 static int _device_open_queue_buffers(us_device_s *dev);
 static int _device_open_export_to_dma(us_device_s *dev);
+static void _device_update_grab_interval(us_device_s *dev, const struct v4l2_buffer *buf, ldf grab_ts);
+static uint _device_get_auto_n_bufs(us_device_s *dev);
 static int _device_apply_resolution(us_device_s *dev, uint width, uint height, float hz);
 
 static void _device_apply_controls(us_device_s *dev);
@@ -122,6 +143,16 @@ us_device_s *us_device_init(void) {
 	us_device_runtime_s *run;
 	US_CALLOC(run, 1);
 	run->fd = -1;
+	atomic_init(&run->drops.lost, 0);
+	atomic_init(&run->drops.skipped, 0);
+	atomic_init(&run->drops.broken, 0);
+	atomic_init(&run->drops.truncated, 0);
+	atomic_init(&run->drops.starved, 0);
+	atomic_init(&run->n_released, 0);
+	atomic_init(&run->bufs_stat.n_bufs, 0);
+	atomic_init(&run->bufs_stat.queued, 0);
+	atomic_init(&run->bufs_stat.queued_min, 0);
+	atomic_init(&run->bufs_stat.hold_us, 0);
 
 	us_device_s *dev;
 	US_CALLOC(dev, 1);
@@ -140,6 +171,7 @@ us_device_s *us_device_init(void) {
 }
 
 void us_device_destroy(us_device_s *dev) {
+	_device_free_heap_buffers(dev);
 	free(dev->run);
 	free(dev);
 }
@@ -174,6 +206,14 @@ int us_device_parse_io_method(const char *str) {
 int us_device_open(us_device_s *dev) {
 	us_device_runtime_s *const run = dev->run;
 
+	run->has_sequence = false;
+	run->grab_interval = 0;
+	run->rate_ts = 0;
+	run->n_starved = 0;
+	run->starved_ts = 0;
+	atomic_store(&run->n_released, 0);
+	atomic_store(&run->bufs_stat.hold_us, 0);
+
 	if (access(dev->path, R_OK | W_OK) < 0) {
 		if (run->open_error_reported != -errno) {
 			run->open_error_reported = -errno; // Don't confuse it with __LINE__
@@ -221,7 +261,12 @@ int us_device_open(us_device_s *dev) {
 	if (_device_open_queue_buffers(dev) < 0) {
 		goto error;
 	}
-	if (dev->dma_export && !us_is_jpeg(run->format)) {
+	atomic_store(&run->bufs_stat.n_bufs, run->n_bufs);
+	atomic_store(&run->bufs_stat.queued, run->n_bufs);
+	atomic_store(&run->bufs_stat.queued_min, run->n_bufs);
+	if (dev->io_method == V4L2_MEMORY_DMABUF) {
+		run->dma = true; // The heap buffers are DMA already
+	} else if (dev->dma_export && !us_is_jpeg(run->format)) {
 		// uStreamer doesn't have any component that could handle JPEG capture via DMA
 		run->dma = !_device_open_export_to_dma(dev);
 		if (!run->dma && dev->dma_required) {
@@ -266,23 +311,38 @@ void us_device_close(us_device_s *dev) {
 		run->streamon = false;
 	}
 
+	if (dev->auto_bufs) {
+		// Shrinking is applied only on the reopening, growing is in us_device_grab_buffer()
+		const uint n_bufs = _device_get_auto_n_bufs(dev);
+		if (n_bufs > 0 && n_bufs != dev->n_bufs) {
+			_D_LOG_INFO("Auto buffers: %u -> %u for the next opening", dev->n_bufs, n_bufs);
+			dev->n_bufs = n_bufs;
+		}
+	}
+	atomic_store(&run->bufs_stat.n_bufs, 0);
+	atomic_store(&run->bufs_stat.queued, 0);
+	atomic_store(&run->bufs_stat.queued_min, 0);
+
 	if (run->hw_bufs != NULL) {
 		say = true;
 		_D_LOG_DEBUG("Releasing HW buffers ...");
 		for (uint index = 0; index < run->n_bufs; ++index) {
 			us_hw_buffer_s *hw = &run->hw_bufs[index];
 
-			US_CLOSE_FD(hw->dma_fd);
-
 			if (dev->io_method == V4L2_MEMORY_MMAP) {
+				US_CLOSE_FD(hw->dma_fd);
 				if (hw->raw.allocated > 0 && hw->raw.data != NULL) {
 					if (munmap(hw->raw.data, hw->raw.allocated) < 0) {
 						_D_LOG_PERROR("Can't unmap HW buffer=%u", index);
 					}
 				}
-			} else { // V4L2_MEMORY_USERPTR
-				US_DELETE(hw->raw.data, free);
+			} else if (dev->io_method == V4L2_MEMORY_USERPTR) {
+				US_CLOSE_FD(hw->dma_fd);
+				us_hugepages_free(hw->raw.data, hw->raw.allocated);
+				hw->raw.data = NULL;
 			}
+			// The DMABUF heap buffers are not released here to be reused
+			// after the reopening, see us_device_destroy()
 
 			if (run->capture_mplane) {
 				free(hw->buf.m.planes);
@@ -290,6 +350,7 @@ void us_device_close(us_device_s *dev) {
 		}
 		US_DELETE(run->hw_bufs, free);
 		run->n_bufs = 0;
+		run->dma = false;
 	}
 
 	US_CLOSE_FD(run->fd);
@@ -342,6 +403,7 @@ int us_device_grab_buffer(us_device_s *dev, us_hw_buffer_s **hw) {
 		const bool new_got = (us_xioctl(run->fd, VIDIOC_DQBUF, &new) >= 0);
 
 		if (new_got) {
+			atomic_fetch_sub(&run->bufs_stat.queued, 1);
 			if (new.index >= run->n_bufs) {
 				_D_LOG_ERROR("V4L2 error: grabbed invalid HW buffer=%u, n_bufs=%u", new.index, run->n_bufs);
 				return -1;
@@ -355,6 +417,16 @@ int us_device_grab_buffer(us_device_s *dev, us_hw_buffer_s **hw) {
 				return -1;
 			}
 			GRABBED(new) = true;
+			_device_sync_dma(dev, new.index, true);
+
+			// The driver counts all of the frames including the ones it had no buffers for
+			if (run->has_sequence && new.sequence > run->last_sequence + 1) {
+				const u32 lost = new.sequence - run->last_sequence - 1;
+				atomic_fetch_add(&run->drops.lost, lost);
+				_D_LOG_DEBUG("Lost %u frames in the driver: sequence=%u->%u", lost, run->last_sequence, new.sequence);
+			}
+			run->last_sequence = new.sequence;
+			run->has_sequence = true;
 
 			if (run->capture_mplane) {
 				new.bytesused = new.m.planes[0].bytesused;
@@ -363,20 +435,25 @@ int us_device_grab_buffer(us_device_s *dev, us_hw_buffer_s **hw) {
 			broken = !_device_is_buffer_valid(dev, &new, FRAME_DATA(new));
 			if (broken) {
 				_D_LOG_DEBUG("Releasing HW buffer=%u (broken frame) ...", new.index);
+				_device_sync_dma(dev, new.index, false);
 				if (us_xioctl(run->fd, VIDIOC_QBUF, &new) < 0) {
 					_D_LOG_PERROR("Can't release HW buffer=%u (broken frame)", new.index);
 					return -1;
 				}
 				GRABBED(new) = false;
+				atomic_fetch_add(&run->bufs_stat.queued, 1);
 				continue;
 			}
 
 			if (buf_got) {
+				_device_sync_dma(dev, buf.index, false);
 				if (us_xioctl(run->fd, VIDIOC_QBUF, &buf) < 0) {
 					_D_LOG_PERROR("Can't release HW buffer=%u (skipped frame)", buf.index);
 					return -1;
 				}
 				GRABBED(buf) = false;
+				atomic_fetch_add(&run->bufs_stat.queued, 1);
+				atomic_fetch_add(&run->drops.skipped, 1);
 				++skipped;
 				// buf_got = false;
 			}
@@ -400,6 +477,30 @@ int us_device_grab_buffer(us_device_s *dev, us_hw_buffer_s **hw) {
 		}
 	} while (true);
 
+	const uint queued = atomic_load(&run->bufs_stat.queued);
+	if (queued < atomic_load(&run->bufs_stat.queued_min)) {
+		atomic_store(&run->bufs_stat.queued_min, queued);
+	}
+	if (queued == 0) {
+		// The driver has no buffers to fill until we release something
+		atomic_fetch_add(&run->drops.starved, 1);
+		// Only a series of the starvations is worth the reopening, not the rare ones for hours
+		const ldf now_ts = us_get_now_monotonic();
+		if (run->starved_ts + _AUTO_BUFS_STARVED_WINDOW < now_ts) {
+			run->n_starved = 0;
+			run->starved_ts = now_ts;
+		}
+		++run->n_starved;
+		if (dev->auto_bufs && run->n_starved >= _AUTO_BUFS_MAX_STARVED) {
+			const uint n_bufs = _device_get_auto_n_bufs(dev);
+			if (n_bufs > run->n_bufs) {
+				_D_LOG_INFO("Auto buffers: starving with %u buffers, reopening with %u ...", run->n_bufs, n_bufs);
+				dev->n_bufs = n_bufs;
+				return -1;
+			}
+		}
+	}
+
 	*hw = &run->hw_bufs[buf.index];
 	atomic_store(&(*hw)->refs, 0);
 	(*hw)->raw.dma_fd = (*hw)->dma_fd;
@@ -411,6 +512,8 @@ int us_device_grab_buffer(us_device_s *dev, us_hw_buffer_s **hw) {
 	(*hw)->raw.online = true;
 	_v4l2_buffer_copy(&buf, &(*hw)->buf);
 	(*hw)->raw.grab_ts = (ldf)((buf.timestamp.tv_sec * (u64)1000) + (buf.timestamp.tv_usec / 1000)) / 1000;
+	(*hw)->grabbed_ts = us_get_now_monotonic();
+	_device_update_grab_interval(dev, &buf, (*hw)->raw.grab_ts);
 
 	_D_LOG_DEBUG("Grabbed HW buffer=%u: bytesused=%u, grab_ts=%.3Lf, latency=%.3Lf, skipped=%u",
 		buf.index, buf.bytesused, (*hw)->raw.grab_ts, us_get_now_monotonic() - (*hw)->raw.grab_ts, skipped);
@@ -421,11 +524,20 @@ int us_device_release_buffer(us_device_s *dev, us_hw_buffer_s *hw) {
 	assert(atomic_load(&hw->refs) == 0);
 	const uint index = hw->buf.index;
 	_D_LOG_DEBUG("Releasing HW buffer=%u ...", index);
+	_device_sync_dma(dev, index, false);
 	if (us_xioctl(dev->run->fd, VIDIOC_QBUF, &hw->buf) < 0) {
 		_D_LOG_PERROR("Can't release HW buffer=%u", index);
 		return -1;
 	}
 	hw->grabbed = false;
+	atomic_fetch_add(&dev->run->bufs_stat.queued, 1);
+
+	// The peak decays slowly to follow the consumers which became faster
+	const uint hold_us = (us_get_now_monotonic() - hw->grabbed_ts) * 1000000;
+	const uint peak_us = atomic_load(&dev->run->bufs_stat.hold_us) * 0.99;
+	atomic_store(&dev->run->bufs_stat.hold_us, US_MAX(hold_us, peak_us));
+	atomic_fetch_add(&dev->run->n_released, 1);
+
 	_D_LOG_DEBUG("HW buffer=%u released", index);
 	return 0;
 }
@@ -518,6 +630,7 @@ bool _device_is_buffer_valid(us_device_s *dev, const struct v4l2_buffer *buf, co
 	if (buf->bytesused < dev->min_frame_size) {
 		_D_LOG_DEBUG("Dropped too small frame, assuming it was broken: buffer=%u, bytesused=%u",
 			buf->index, buf->bytesused);
+		atomic_fetch_add(&dev->run->drops.broken, 1);
 		return false;
 	}
 
@@ -526,13 +639,13 @@ bool _device_is_buffer_valid(us_device_s *dev, const struct v4l2_buffer *buf, co
 	// large amounts of these frames when using MJPEG streams. Checks that the
 	// buffer ends with either the JPEG end of image marker (0xFFD9), the last
 	// marker byte plus a padding byte (0xD900), or just padding bytes (0x0000)
-	// A more sophisticated method would scan for the end of image marker, but
-	// that takes precious CPU cycles and this should be good enough for most
-	// cases.
+	// A more sophisticated method which walks over all of the segments is
+	// enabled by --jpeg-check, see us_jpeg_check().
 	if (us_is_jpeg(dev->run->format)) {
 		if (buf->bytesused < 125) {
 			// https://stackoverflow.com/questions/2253404/what-is-the-smallest-valid-jpeg-file-size-in-bytes
 			_D_LOG_DEBUG("Discarding invalid frame, too small to be a valid JPEG: bytesused=%u", buf->bytesused);
+			atomic_fetch_add(&dev->run->drops.broken, 1);
 			return false;
 		}
 
@@ -541,6 +654,14 @@ bool _device_is_buffer_valid(us_device_s *dev, const struct v4l2_buffer *buf, co
 		const u16 eoi_marker = (((u16)(eoi_ptr[0]) << 8) | eoi_ptr[1]);
 		if (eoi_marker != 0xFFD9 && eoi_marker != 0xD900 && eoi_marker != 0x0000) {
 			_D_LOG_DEBUG("Discarding truncated JPEG frame: eoi_marker=0x%04x, bytesused=%u", eoi_marker, buf->bytesused);
+			atomic_fetch_add(&dev->run->drops.truncated, 1);
+			return false;
+		}
+
+		const char *reason;
+		if (dev->jpeg_check && !us_jpeg_check(data, buf->bytesused, &reason)) {
+			_D_LOG_DEBUG("Discarding invalid JPEG frame: %s, bytesused=%u", reason, buf->bytesused);
+			atomic_fetch_add(&dev->run->drops.broken, 1);
 			return false;
 		}
 	}
@@ -678,7 +799,8 @@ probe_only:
 static int _device_open_format(us_device_s *dev, bool first) {
 	us_device_runtime_s *const run = dev->run;
 
-	const uint stride = us_align_size(run->width, 32) << 1;
+	// The planar formats are requested with the stride of the luma plane
+	const uint stride = us_align_size(run->width, 32) << (us_get_bytes_per_pixel(dev->format) == 1 ? 0 : 1);
 
 	struct v4l2_format fmt = {0};
 	fmt.type = run->capture_type;
@@ -749,7 +871,7 @@ static int _device_open_format(us_device_s *dev, bool first) {
 
 
 	run->stride = FMTS(bytesperline);
-	run->raw_size = FMTS(sizeimage); // Only for userptr
+	run->raw_size = FMTS(sizeimage); // Only for USERPTR and DMABUF
 
 #	undef FMTS
 #	undef FMT
@@ -834,6 +956,7 @@ static int _device_open_io_method(us_device_s *dev) {
 	switch (dev->io_method) {
 		case V4L2_MEMORY_MMAP: return _device_open_io_method_mmap(dev);
 		case V4L2_MEMORY_USERPTR: return _device_open_io_method_userptr(dev);
+		case V4L2_MEMORY_DMABUF: return _device_open_io_method_dmabuf(dev);
 		default: assert(0 && "Unsupported IO method");
 	}
 	return -1;
@@ -932,14 +1055,63 @@ static int _device_open_io_method_userptr(us_device_s *dev) {
 
 	US_CALLOC(run->hw_bufs, req.count);
 
-	const uint page_size = getpagesize();
-	const uint buf_size = us_align_size(run->raw_size, page_size);
+	uint n_hugetlb = 0;
+	for (run->n_bufs = 0; run->n_bufs < req.count; ++run->n_bufs) {
+		us_hw_buffer_s *hw = &run->hw_bufs[run->n_bufs];
+		bool hugetlb;
+		hw->raw.data = us_hugepages_alloc(run->raw_size, &hw->raw.allocated, &hugetlb);
+		n_hugetlb += hugetlb;
+		hw->dma_fd = -1;
+		if (run->capture_mplane) {
+			US_CALLOC(hw->buf.m.planes, VIDEO_MAX_PLANES);
+		}
+	}
+	_D_LOG_INFO("Allocated %u USERPTR buffers, size=%zu: %u from reserved hugepages, %u with THP advice",
+		run->n_bufs, run->hw_bufs[0].raw.allocated, n_hugetlb, run->n_bufs - n_hugetlb);
+	return 0;
+}
+
+static int _device_open_io_method_dmabuf(us_device_s *dev) {
+	us_device_runtime_s *const run = dev->run;
+
+	struct v4l2_requestbuffers req = {
+		.count = dev->n_bufs,
+		.type = run->capture_type,
+		.memory = V4L2_MEMORY_DMABUF,
+	};
+	_D_LOG_DEBUG("Requesting %u device buffers for DMABUF ...", req.count);
+	if (us_xioctl(run->fd, VIDIOC_REQBUFS, &req) < 0) {
+		_D_LOG_PERROR("Device '%s' doesn't support DMABUF method", dev->path);
+		return -1;
+	}
+
+	if (req.count < 1) {
+		_D_LOG_ERROR("Insufficient buffer memory: %u", req.count);
+		return -1;
+	} else {
+		_D_LOG_INFO("Requested %u device buffers, got %u", dev->n_bufs, req.count);
+	}
+
+	// The heap buffers are owned by the device object, not by the capture session,
+	// so the consumers which imported them keep the same FDs after the reopening.
+	const uz buf_size = us_align_size(run->raw_size, getpagesize());
+	if (run->n_heap_bufs < req.count || run->heap_bufs[0].allocated < buf_size) {
+		_device_free_heap_buffers(dev);
+		if (_device_alloc_heap_buffers(dev, req.count, buf_size) < 0) {
+			return -1;
+		}
+	} else {
+		_D_LOG_INFO("Reusing %u DMA heap buffers", req.count);
+	}
+
+	US_CALLOC(run->hw_bufs, req.count);
 
 	for (run->n_bufs = 0; run->n_bufs < req.count; ++run->n_bufs) {
 		us_hw_buffer_s *hw = &run->hw_bufs[run->n_bufs];
-		assert((hw->raw.data = aligned_alloc(page_size, buf_size)) != NULL);
-		memset(hw->raw.data, 0, buf_size);
-		hw->raw.allocated = buf_size;
+		atomic_init(&hw->refs, 0);
+		hw->raw.data = run->heap_bufs[run->n_bufs].data;
+		hw->raw.allocated = run->heap_bufs[run->n_bufs].allocated;
+		hw->dma_fd = run->heap_bufs[run->n_bufs].fd;
 		if (run->capture_mplane) {
 			US_CALLOC(hw->buf.m.planes, VIDEO_MAX_PLANES);
 		}
@@ -947,6 +1119,94 @@ static int _device_open_io_method_userptr(us_device_s *dev) {
 	return 0;
 }
 
+static int _device_alloc_heap_buffers(us_device_s *dev, uint n_bufs, uz size) {
+	us_device_runtime_s *const run = dev->run;
+
+	int heap_fd = -1;
+	if (dev->dma_heap_path != NULL) {
+		if ((heap_fd = open(dev->dma_heap_path, O_RDWR | O_CLOEXEC)) < 0) {
+			_D_LOG_PERROR("Can't open DMA heap %s", dev->dma_heap_path);
+			return -1;
+		}
+	} else {
+		// CMA is contiguous, so it's suitable for the devices without IOMMU
+		const char *const paths[] = {"/dev/dma_heap/linux,cma", "/dev/dma_heap/system"};
+		for (uint index = 0; index < US_ARRAY_LEN(paths) && heap_fd < 0; ++index) {
+			if ((heap_fd = open(paths[index], O_RDWR | O_CLOEXEC)) >= 0) {
+				_D_LOG_INFO("Using DMA heap: %s", paths[index]);
+			}
+		}
+		if (heap_fd < 0) {
+			_D_LOG_ERROR("Can't find any DMA heap in /dev/dma_heap");
+			return -1;
+		}
+	}
+
+	_D_LOG_DEBUG("Allocating %u DMA heap buffers, size=%zu ...", n_bufs, size);
+
+	US_CALLOC(run->heap_bufs, n_bufs);
+
+	for (run->n_heap_bufs = 0; run->n_heap_bufs < n_bufs;) {
+		us_dma_heap_buffer_s *const buf = &run->heap_bufs[run->n_heap_bufs];
+		struct dma_heap_allocation_data data = {
+			.len = size,
+			.fd_flags = O_RDWR | O_CLOEXEC,
+		};
+		if (us_xioctl(heap_fd, DMA_HEAP_IOCTL_ALLOC, &data) < 0) {
+			_D_LOG_PERROR("Can't allocate DMA heap buffer=%u", run->n_heap_bufs);
+			goto error;
+		}
+		buf->fd = data.fd;
+		++run->n_heap_bufs;
+
+		u8 *const mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, buf->fd, 0);
+		if (mapped == MAP_FAILED) {
+			_D_LOG_PERROR("Can't map DMA heap buffer=%u", run->n_heap_bufs - 1);
+			goto error;
+		}
+		buf->data = mapped;
+		buf->allocated = size;
+	}
+
+	close(heap_fd);
+	return 0;
+
+error:
+	close(heap_fd);
+	_device_free_heap_buffers(dev);
+	return -1;
+}
+
+static void _device_free_heap_buffers(us_device_s *dev) {
+	us_device_runtime_s *const run = dev->run;
+	if (run->heap_bufs == NULL) {
+		return;
+	}
+	_D_LOG_DEBUG("Releasing DMA heap buffers ...");
+	for (uint index = 0; index < run->n_heap_bufs; ++index) {
+		us_dma_heap_buffer_s *const buf = &run->heap_bufs[index];
+		if (buf->data != NULL && munmap(buf->data, buf->allocated) < 0) {
+			_D_LOG_PERROR("Can't unmap DMA heap buffer=%u", index);
+		}
+		US_CLOSE_FD(buf->fd);
+	}
+	US_DELETE(run->heap_bufs, free);
+	run->n_heap_bufs = 0;
+}
+
+static void _device_sync_dma(us_device_s *dev, uint index, bool start) {
+	// The heap buffers may be cached, so the CPU access must be bracketed
+	if (dev->io_method != V4L2_MEMORY_DMABUF) {
+		return;
+	}
+	struct dma_buf_sync sync = {
+		.flags = (start ? DMA_BUF_SYNC_START : DMA_BUF_SYNC_END) | DMA_BUF_SYNC_READ,
+	};
+	if (us_xioctl(dev->run->hw_bufs[index].dma_fd, DMA_BUF_IOCTL_SYNC, &sync) < 0) {
+		_D_LOG_PERROR("Can't sync DMA heap buffer=%u", index);
+	}
+}
+
 static int _device_open_queue_buffers(us_device_s *dev) {
 	us_device_runtime_s *const run = dev->run;
 
@@ -966,6 +1226,14 @@ static int _device_open_queue_buffers(us_device_s *dev) {
 			// but i don't have one which supports V4L2_MEMORY_USERPTR
 			buf.m.userptr = (unsigned long)run->hw_bufs[index].raw.data;
 			buf.length = run->hw_bufs[index].raw.allocated;
+		} else if (dev->io_method == V4L2_MEMORY_DMABUF) {
+			if (run->capture_mplane) {
+				planes[0].m.fd = run->hw_bufs[index].dma_fd;
+				planes[0].length = run->hw_bufs[index].raw.allocated;
+			} else {
+				buf.m.fd = run->hw_bufs[index].dma_fd;
+				buf.length = run->hw_bufs[index].raw.allocated;
+			}
 		}
 
 		_D_LOG_DEBUG("Calling us_xioctl(VIDIOC_QBUF) for buffer=%u ...", index);
@@ -1001,6 +1269,32 @@ error:
 	return -1;
 }
 
+static void _device_update_grab_interval(us_device_s *dev, const struct v4l2_buffer *buf, ldf grab_ts) {
+	// The driver's timestamps and sequence numbers don't depend on our slowdown and skipped frames
+	us_device_runtime_s *const run = dev->run;
+	if (run->rate_ts > 0 && grab_ts > run->rate_ts && buf->sequence > run->rate_sequence) {
+		const ldf interval = (grab_ts - run->rate_ts) / (buf->sequence - run->rate_sequence);
+		run->grab_interval = (run->grab_interval > 0 ? run->grab_interval * 0.9 + interval * 0.1 : interval);
+	}
+	run->rate_ts = grab_ts;
+	run->rate_sequence = buf->sequence;
+}
+
+static uint _device_get_auto_n_bufs(us_device_s *dev) {
+	// The consumers hold the buffers for hold/interval frames,
+	// plus one for the driver to fill and one spare for the jitter.
+	const us_device_runtime_s *const run = dev->run;
+	if (run->grab_interval <= 0 || atomic_load(&run->n_released) < _AUTO_BUFS_MIN_SAMPLES) {
+		return 0; // Not enough statistics
+	}
+	const ldf held = (ldf)atomic_load(&run->bufs_stat.hold_us) / 1000000 / run->grab_interval;
+	uint n_bufs = held;
+	if (n_bufs < held) {
+		++n_bufs;
+	}
+	return US_MIN(US_MAX(n_bufs + 2, (uint)2), (uint)32);
+}
+
 static int _device_apply_resolution(us_device_s *dev, uint width, uint height, float hz) {
 	// Тут VIDEO_MIN_* не используются из-за странностей минимального разрешения при отсутствии сигнала
 	// у некоторых устройств, например TC358743
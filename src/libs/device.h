@@ -39,8 +39,8 @@
 #define US_VIDEO_MAX_FPS		((uint)120)
 
 #define US_STANDARDS_STR		"PAL, NTSC, SECAM"
-#define US_FORMATS_STR			"YUYV, YVYU, UYVY, RGB565, RGB24, BGR24, MJPEG, JPEG"
-#define US_IO_METHODS_STR		"MMAP, USERPTR"
+#define US_FORMATS_STR			"YUYV, YVYU, UYVY, RGB565, RGB24, BGR24, NV12, NV16, YUV420, GREY, MJPEG, JPEG"
+#define US_IO_METHODS_STR		"MMAP, USERPTR, DMABUF"
 
 
 typedef struct {
@@ -48,9 +48,31 @@ typedef struct {
 	struct v4l2_buffer	buf;
 	int					dma_fd;
 	bool				grabbed;
+	ldf					grabbed_ts; // Monotonic, for the hold time
 	atomic_int			refs;
 } us_hw_buffer_s;
 
+typedef struct {
+	int		fd;
+	u8		*data;
+	uz		allocated;
+} us_dma_heap_buffer_s;
+
+typedef struct {
+	atomic_ullong	lost;		// Gaps in the driver's sequence numbers
+	atomic_ullong	skipped;	// Requeued in favor of a fresher frame
+	atomic_ullong	broken;		// Smaller than --min-frame-size or than any valid JPEG
+	atomic_ullong	truncated;	// JPEG without the end marker
+	atomic_ullong	starved;	// Grabbed while all of the other buffers were in use too
+} us_device_drops_s;
+
+typedef struct {
+	atomic_uint		n_bufs;
+	atomic_uint		queued;		// Owned by the driver right now
+	atomic_uint		queued_min;	// Since the opening
+	atomic_uint		hold_us;	// Decaying peak of the time from grabbing to releasing
+} us_device_bufs_stat_s;
+
 typedef struct {
 	int					fd;
 	uint				width;
@@ -63,11 +85,23 @@ typedef struct {
 	uz					raw_size;
 	uint				n_bufs;
 	us_hw_buffer_s		*hw_bufs;
+	us_dma_heap_buffer_s *heap_bufs; // For DMABUF, survives the reopening
+	uint				n_heap_bufs;
 	bool				dma;
 	enum v4l2_buf_type	capture_type;
 	bool				capture_mplane;
 	bool				streamon;
 	int					open_error_reported;
+	bool				has_sequence;
+	u32					last_sequence;
+	ldf					grab_interval; // Average between the frames of the source, for --buffers=auto
+	ldf					rate_ts;
+	u32					rate_sequence;
+	atomic_uint			n_released;
+	uint				n_starved; // Since starved_ts
+	ldf					starved_ts;
+	us_device_drops_s	drops; // Since the start of the program
+	us_device_bufs_stat_s bufs_stat;
 } us_device_runtime_s;
 
 typedef enum {
@@ -107,12 +141,15 @@ typedef struct {
 	uint				jpeg_quality;
 	v4l2_std_id			standard;
 	enum v4l2_memory	io_method;
+	char				*dma_heap_path; // For DMABUF, NULL to auto-select
 	bool				dv_timings;
 	uint				n_bufs;
+	bool				auto_bufs; // n_bufs is adjusted on the fly
 	bool				dma_export;
 	bool				dma_required;
 	uint				desired_fps;
 	uz					min_frame_size;
+	bool				jpeg_check;
 	bool				persistent;
 	uint				timeout;
 	us_controls_s 		ctl;
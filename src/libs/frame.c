@@ -31,6 +31,7 @@
 
 #include "types.h"
 #include "tools.h"
+#include "hugepages.h"
 
 
 us_frame_s *us_frame_init(void) {
@@ -50,6 +51,10 @@ void us_frame_realloc_data(us_frame_s *frame, uz size) {
 	if (frame->allocated < size) {
 		US_REALLOC(frame->data, size);
 		frame->allocated = size;
+		if (size >= US_HUGEPAGE_SIZE) {
+			// The big frames are allocated by mmap() inside of malloc(), so THP can back them
+			us_hugepages_advise(frame->data, size);
+		}
 	}
 }
 
@@ -80,23 +85,33 @@ bool us_frame_compare(const us_frame_s *a, const us_frame_s *b) {
 }
 
 uint us_frame_get_padding(const us_frame_s *frame) {
-	uint bytes_per_pixel = 0;
-	switch (frame->format) {
+	const uint bytes_per_pixel = us_get_bytes_per_pixel(frame->format);
+	if (bytes_per_pixel > 0 && frame->stride > frame->width) {
+		return (frame->stride - frame->width * bytes_per_pixel);
+	}
+	return 0;
+}
+
+uint us_get_bytes_per_pixel(uint format) {
+	// For the planar formats it's the size of the luma pixel,
+	// the stride is the same for the chroma plane of NV12/NV16 and the half (rounded up) for YUV420.
+	switch (format) {
 		case V4L2_PIX_FMT_YUYV:
 		case V4L2_PIX_FMT_YVYU:
 		case V4L2_PIX_FMT_UYVY:
-		case V4L2_PIX_FMT_RGB565: bytes_per_pixel = 2; break;
+		case V4L2_PIX_FMT_RGB565: return 2;
 		case V4L2_PIX_FMT_BGR24:
-		case V4L2_PIX_FMT_RGB24: bytes_per_pixel = 3; break;
+		case V4L2_PIX_FMT_RGB24: return 3;
+		case V4L2_PIX_FMT_NV12:
+		case V4L2_PIX_FMT_NV16:
+		case V4L2_PIX_FMT_YUV420:
+		case V4L2_PIX_FMT_GREY: return 1;
 		// case V4L2_PIX_FMT_H264:
 		case V4L2_PIX_FMT_MJPEG:
-		case V4L2_PIX_FMT_JPEG: bytes_per_pixel = 0; break;
+		case V4L2_PIX_FMT_JPEG: return 0;
 		default: assert(0 && "Unknown format");
 	}
-	if (bytes_per_pixel > 0 && frame->stride > frame->width) {
-		return (frame->stride - frame->width * bytes_per_pixel);
-	}
-	return 0;
+	return 0; // Makes linter happy
 }
 
 bool us_is_jpeg(uint format) {
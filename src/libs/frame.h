@@ -26,6 +26,9 @@
 #include "tools.h"
 
 
+#define US_FRAME_CHANGE_MAP_SIZE 32 // A bit per tile of the 16x16 grid, see tiles.h
+
+
 typedef struct {
 	u8		*data;
 	uz		used;
@@ -46,6 +49,11 @@ typedef struct {
 	ldf		grab_ts;
 	ldf		encode_begin_ts;
 	ldf		encode_end_ts;
+
+	// The tiles which were changed since the previous frame of the same consumer
+	bool	change_mapped;
+	uint	changed_tiles;
+	u8		change_map[US_FRAME_CHANGE_MAP_SIZE];
 } us_frame_s;
 
 
@@ -61,6 +69,10 @@ typedef struct {
 		x_dest->grab_ts = x_src->grab_ts; \
 		x_dest->encode_begin_ts = x_src->encode_begin_ts; \
 		x_dest->encode_end_ts = x_src->encode_end_ts; \
+		\
+		x_dest->change_mapped = x_src->change_mapped; \
+		x_dest->changed_tiles = x_src->changed_tiles; \
+		memcpy(x_dest->change_map, x_src->change_map, US_FRAME_CHANGE_MAP_SIZE); \
 	}
 
 #define US_FRAME_COMPARE_GEOMETRY(x_a, x_b) ( \
@@ -104,5 +116,6 @@ bool us_frame_compare(const us_frame_s *a, const us_frame_s *b);
 
 uint us_frame_get_padding(const us_frame_s *frame);
 
+uint us_get_bytes_per_pixel(uint format);
 bool us_is_jpeg(uint format);
 const char *us_fourcc_to_string(uint format, char *buf, uz size);
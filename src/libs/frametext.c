@@ -37,6 +37,7 @@ static void _frametext_draw_line(
 	us_frametext_s *ft, const char *line,
 	uint scale_x, uint scale_y,
 	uint start_x, uint start_y);
+static const u8 *_frametext_get_atlas_row(us_frametext_s *ft, u8 bits, uint scale_x);
 
 
 us_frametext_s *us_frametext_init(void) {
@@ -48,6 +49,7 @@ us_frametext_s *us_frametext_init(void) {
 
 void us_frametext_destroy(us_frametext_s *ft) {
 	us_frame_destroy(ft->frame);
+	US_DELETE(ft->atlas, free);
 	US_DELETE(ft->text, free);
 	free(ft);
 }
@@ -155,32 +157,56 @@ void _frametext_draw_line(
 
 	us_frame_s *const frame = ft->frame;
 
+	if (scale_x == 0 || scale_y == 0 || start_x >= frame->width) {
+		return;
+	}
+
 	const size_t len = strlen(line);
+	const uz glyph_size = 8 * scale_x * 3;
+	const uz max_size = (frame->width - start_x) * 3;
+
+	for (uint ch_byte = 0; ch_byte < 8; ++ch_byte) {
+		const uint canvas_y = start_y + ch_byte * scale_y;
+		if (canvas_y >= frame->height) {
+			break;
+		}
+		u8 *const row = &frame->data[canvas_y * frame->stride + start_x * 3];
+
+		// Compose the first scanline of the glyph row from the atlas...
+		uz size = 0;
+		for (uz index = 0; index < len && size < max_size; ++index) {
+			const u8 ch = US_MIN((u8)line[index], sizeof(US_FRAMETEXT_FONT) / 8 - 1);
+			const u8 *const glyph_row = _frametext_get_atlas_row(ft, US_FRAMETEXT_FONT[ch][ch_byte], scale_x);
+			const uz glyph_used = US_MIN(glyph_size, max_size - size);
+			memcpy(row + size, glyph_row, glyph_used);
+			size += glyph_used;
+		}
+
+		// ... and just copy it for the vertical scale
+		for (uint ch_y = 1; ch_y < scale_y && canvas_y + ch_y < frame->height; ++ch_y) {
+			memcpy(row + ch_y * frame->stride, row, size);
+		}
+	}
+}
+
+static const u8 *_frametext_get_atlas_row(us_frametext_s *ft, u8 bits, uint scale_x) {
+	// The atlas contains the scaled RGB24 rows for all possible 8-bit font rows.
+	// It's filled lazily and only reset when the scale is changed.
+	const uz row_size = 8 * scale_x * 3;
+	if (ft->atlas_scale_x != scale_x) {
+		US_DELETE(ft->atlas, free);
+		US_CALLOC(ft->atlas, 256 * row_size);
+		memset(ft->atlas_ready, 0, sizeof(ft->atlas_ready));
+		ft->atlas_scale_x = scale_x;
+	}
 
-	for (uint ch_y = 0; ch_y < 8 * scale_y; ++ch_y) {
-		const uint canvas_y = start_y + ch_y;
-		for (uint ch_x = 0; ch_x < 8 * len * scale_x; ++ch_x) {
-			if ((start_x + ch_x) >= frame->width) {
-				break;
-			}
-			const uint canvas_x = (start_x + ch_x) * 3;
-			const uint offset = canvas_y * frame->stride + canvas_x;
-			if (offset >= frame->used) {
-				break;
-			}
-
-			const u8 ch = US_MIN((u8)line[ch_x / 8 / scale_x], sizeof(US_FRAMETEXT_FONT) / 8 - 1);
-			const uint ch_byte = (ch_y / scale_y) % 8;
-			const uint ch_bit = (ch_x / scale_x) % 8;
-			const bool pix_on = !!(US_FRAMETEXT_FONT[ch][ch_byte] & (1 << ch_bit));
-
-			u8 *const r = &frame->data[offset];
-			u8 *const g = r + 1;
-			u8 *const b = r + 2;
-
-			*r = pix_on * 0x65; // RGB/BGR-friendly
-			*g = pix_on * 0x65;
-			*b = pix_on * 0x65;
+	u8 *const row = &ft->atlas[bits * row_size];
+	if (!ft->atlas_ready[bits]) {
+		for (uint bit = 0; bit < 8; ++bit) {
+			const u8 value = ((bits >> bit) & 1) * 0x65; // RGB/BGR-friendly
+			memset(row + bit * scale_x * 3, value, scale_x * 3);
 		}
+		ft->atlas_ready[bits] = true;
 	}
+	return row;
 }
@@ -30,6 +30,10 @@
 typedef struct {
 	char		*text;
 	us_frame_s	*frame;
+
+	u8			*atlas; // Scaled glyph rows
+	uint		atlas_scale_x;
+	bool		atlas_ready[256];
 } us_frametext_s;
 
 
@@ -0,0 +1,70 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2023  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#include "hugepages.h"
+
+#include <stdint.h>
+#include <assert.h>
+
+#include <sys/mman.h>
+
+#include "types.h"
+#include "tools.h"
+
+
+u8 *us_hugepages_alloc(uz size, uz *allocated, bool *hugetlb) {
+	// Multi-megabyte frames are scanned by the encoders line by line,
+	// so with 4K pages every few lines cost a TLB miss on the small ARM cores.
+	// The reserved hugepages are used first, then the transparent ones,
+	// if neither is available it's just a regular page-aligned mapping.
+
+	const uz huge_size = us_align_size(size, US_HUGEPAGE_SIZE);
+	u8 *data = mmap(NULL, huge_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (data != MAP_FAILED) {
+		*allocated = huge_size;
+		*hugetlb = true;
+		return data;
+	}
+
+	assert((data = mmap(NULL, huge_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) != MAP_FAILED);
+	us_hugepages_advise(data, huge_size);
+	*allocated = huge_size;
+	*hugetlb = false;
+	return data;
+}
+
+void us_hugepages_free(u8 *data, uz allocated) {
+	if (data != NULL) {
+		assert(!munmap(data, allocated));
+	}
+}
+
+void us_hugepages_advise(void *data, uz size) {
+	// Only the whole hugepages inside the range can be backed,
+	// the errors are ignored because THP may be just disabled.
+	const uintptr_t begin = us_align_size((uintptr_t)data, US_HUGEPAGE_SIZE);
+	const uintptr_t end = ((uintptr_t)data + size) & ~(uintptr_t)(US_HUGEPAGE_SIZE - 1);
+	if (end > begin) {
+		madvise((void*)begin, end - begin, MADV_HUGEPAGE);
+	}
+}
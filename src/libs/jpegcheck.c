@@ -0,0 +1,122 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2023  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#include "jpegcheck.h"
+
+#include <string.h>
+
+#include "types.h"
+
+
+bool us_jpeg_check(const u8 *data, uz size, const char **reason) {
+	// A structural check of the markers and the segment lengths without any decoding.
+	// The entropy-coded data is scanned for 0xFF using memchr(), which is vectorized by libc,
+	// so the check runs at the memory bandwidth.
+
+#	define FAIL(x_reason) { \
+			*reason = x_reason; \
+			return false; \
+		}
+
+	if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) {
+		FAIL("no SOI");
+	}
+
+	bool sof_found = false;
+	bool sos_found = false;
+	uz pos = 2;
+	while (true) {
+		if (pos + 2 > size) {
+			FAIL("no EOI");
+		}
+		if (data[pos] != 0xFF) {
+			FAIL("garbage between the segments");
+		}
+		while (pos + 1 < size && data[pos + 1] == 0xFF) {
+			++pos; // Fill bytes
+		}
+		if (pos + 2 > size) {
+			FAIL("no EOI");
+		}
+		const u8 marker = data[pos + 1];
+		pos += 2;
+
+		if (marker == 0xD9) { // EOI
+			if (!sos_found) {
+				FAIL("EOI before SOS");
+			}
+			break; // Anything after EOI is a padding
+		} else if (marker == 0xD8) {
+			FAIL("unexpected SOI");
+		} else if (marker == 0x00) {
+			FAIL("stuffed byte outside of the scan");
+		} else if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+			continue; // TEM and RSTn have no length
+		}
+
+		if (pos + 2 > size) {
+			FAIL("truncated segment header");
+		}
+		const uz length = (((uz)data[pos] << 8) | data[pos + 1]);
+		if (length < 2 || pos + length > size) {
+			FAIL("invalid segment length");
+		}
+
+		if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+			sof_found = true;
+		} else if (marker == 0xDA) { // SOS
+			if (!sof_found) {
+				FAIL("SOS before SOF");
+			}
+			sos_found = true;
+			pos += length;
+
+			// Find the next marker except RSTn and the stuffed 0xFF00
+			while (true) {
+				const u8 *const ff = memchr(data + pos, 0xFF, size - pos);
+				if (ff == NULL) {
+					FAIL("no EOI");
+				}
+				pos = ff - data;
+				if (pos + 1 >= size) {
+					FAIL("no EOI");
+				}
+				const u8 next = data[pos + 1];
+				if (next == 0x00 || (next >= 0xD0 && next <= 0xD7)) {
+					pos += 2;
+				} else if (next == 0xFF) {
+					pos += 1;
+				} else {
+					break;
+				}
+			}
+			continue;
+		}
+		pos += length;
+	}
+
+#	undef FAIL
+
+	*reason = NULL;
+	return true;
+}
@@ -26,17 +26,22 @@
 #include <string.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <limits.h>
 #include <assert.h>
 
 #include <sys/file.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <linux/futex.h>
 
 #include "types.h"
 #include "tools.h"
 #include "logging.h"
 #include "frame.h"
 #include "memsinksh.h"
+#include "hugepages.h"
 
 
 us_memsink_s *us_memsink_init(
@@ -79,6 +84,10 @@ us_memsink_s *us_memsink_init(
 		US_LOG_PERROR("%s-sink: Can't mmap shared memory", name);
 		goto error;
 	}
+	if (sink->server) {
+		// Works only with shmem_enabled=advise, but the frames copying is cheaper with it
+		us_hugepages_advise(sink->mem, sizeof(us_memsink_shared_s) + sink->data_size);
+	}
 	return sink;
 
 error:
@@ -195,6 +204,12 @@ int us_memsink_server_put(us_memsink_s *sink, const us_frame_s *frame, bool *key
 			US_LOG_PERROR("%s-sink: Can't unlock memory", sink->name);
 			return -1;
 		}
+
+		atomic_fetch_add(&sink->mem->put_seq, 1);
+		if (atomic_load(&sink->mem->waiters) > 0) {
+			syscall(SYS_futex, &sink->mem->put_seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+		}
+
 		US_LOG_VERBOSE("%s-sink: Exposed new frame; full exposition time = %.3Lf",
 			sink->name, us_get_now_monotonic() - now);
 
@@ -211,6 +226,9 @@ int us_memsink_server_put(us_memsink_s *sink, const us_frame_s *frame, bool *key
 int us_memsink_client_get(us_memsink_s *sink, us_frame_s *frame, bool *key_requested, bool key_required) {
 	assert(!sink->server); // Client only
 
+	// Before the checking, so a put after that always interrupts us_memsink_client_wait()
+	sink->last_put_seq = atomic_load(&sink->mem->put_seq);
+
 	if (us_flock_timedwait_monotonic(sink->fd, sink->timeout) < 0) {
 		if (errno == EWOULDBLOCK) {
 			return -2;
@@ -257,3 +275,20 @@ done:
 	}
 	return retval;
 }
+
+int us_memsink_client_wait(us_memsink_s *sink) {
+	// Sleeps after us_memsink_client_get() returned -2 until the next put
+	// or the sink timeout, so the clients don't have to poll the memory.
+	assert(!sink->server); // Client only
+
+	const struct timespec timeout = {.tv_sec = sink->timeout};
+	atomic_fetch_add(&sink->mem->waiters, 1);
+	const long retval = syscall(SYS_futex, &sink->mem->put_seq, FUTEX_WAIT, sink->last_put_seq, &timeout, NULL, 0);
+	atomic_fetch_sub(&sink->mem->waiters, 1);
+
+	if (retval < 0 && errno != EAGAIN && errno != ETIMEDOUT && errno != EINTR) {
+		US_LOG_PERROR("%s-sink: Can't wait for a new frame", sink->name);
+		return -1;
+	}
+	return 0;
+}
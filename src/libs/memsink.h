@@ -44,6 +44,7 @@ typedef struct {
 	us_memsink_shared_s	*mem;
 
 	u64			last_readed_id; // Only for client
+	uint		last_put_seq; // Only for client, see us_memsink_client_wait()
 
 	atomic_bool	has_clients; // Only for server results
 	ldf			unsafe_last_client_ts; // Only for server
@@ -60,3 +61,4 @@ bool us_memsink_server_check(us_memsink_s *sink, const us_frame_s *frame);
 int us_memsink_server_put(us_memsink_s *sink, const us_frame_s *frame, bool *key_requested);
 
 int us_memsink_client_get(us_memsink_s *sink, us_frame_s *frame, bool *key_requested, bool key_required);
+int us_memsink_client_wait(us_memsink_s *sink);
@@ -22,11 +22,14 @@
 
 #pragma once
 
+#include <stdatomic.h>
+
 #include "types.h"
+#include "frame.h"
 
 
 #define US_MEMSINK_MAGIC	((u64)0xCAFEBABECAFEBABE)
-#define US_MEMSINK_VERSION	((u32)5)
+#define US_MEMSINK_VERSION	((u32)7)
 
 
 typedef struct {
@@ -48,8 +51,15 @@ typedef struct {
 	ldf		encode_begin_ts;
 	ldf		encode_end_ts;
 
+	bool	change_mapped;
+	uint	changed_tiles;
+	u8		change_map[US_FRAME_CHANGE_MAP_SIZE];
+
 	ldf		last_client_ts;
 	bool	key_requested;
+
+	atomic_uint	put_seq; // A futex, incremented after each put
+	atomic_uint	waiters; // The clients sleeping on put_seq, so the server can skip the wakeup
 } us_memsink_shared_s;
 
 
@@ -0,0 +1,172 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2023  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#include "osd.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "types.h"
+#include "tools.h"
+#include "frametext_font.h"
+
+
+#define _FONT_ROWS	10 // 8 rows of the glyphs with a row of padding above and below
+
+
+static void _osd_update_text(us_osd_s *osd);
+static void _osd_render(us_osd_s *osd);
+
+
+us_osd_s *us_osd_init(const char *format) {
+	us_osd_runtime_s *run;
+	US_CALLOC(run, 1);
+
+	us_osd_s *osd;
+	US_CALLOC(osd, 1);
+	osd->format = format;
+	if (gethostname(osd->hostname, sizeof(osd->hostname)) < 0) {
+		osd->hostname[0] = '\0';
+	}
+	osd->hostname[sizeof(osd->hostname) - 1] = '\0';
+	osd->run = run;
+	return osd;
+}
+
+void us_osd_destroy(us_osd_s *osd) {
+	US_DELETE(osd->run->rows, free);
+	free(osd->run);
+	free(osd);
+}
+
+void us_osd_prepare(us_osd_s *osd, uint width, uint height, us_osd_colorspace_e colorspace) {
+	// Called once per frame before the scanlines conversion.
+	// The text changes once per second, so the box is re-rendered at most so often.
+
+	us_osd_runtime_s *const run = osd->run;
+
+	_osd_update_text(osd);
+
+	const uint scale = US_MAX((uint)1, height / 360);
+	if (run->scale != scale || run->colorspace != colorspace || run->frame_width != width || run->frame_height != height) {
+		run->scale = scale;
+		run->colorspace = colorspace;
+		run->bpp = (colorspace == US_OSD_GREY ? 1 : 3);
+		run->frame_width = width;
+		run->frame_height = height;
+		run->dirty = true;
+	}
+
+	if (run->dirty) {
+		_osd_render(osd);
+		run->dirty = false;
+	}
+}
+
+bool us_osd_has_line(const us_osd_s *osd, uint y) {
+	const us_osd_runtime_s *const run = osd->run;
+	return (run->width > 0 && y >= run->y_offset && y < run->y_offset + run->height);
+}
+
+void us_osd_apply(const us_osd_s *osd, u8 *line, uint y) {
+	// The line is a packed RGB24, YCbCr or grayscale scanline of the frame
+	const us_osd_runtime_s *const run = osd->run;
+	if (us_osd_has_line(osd, y)) {
+		const uint row = (y - run->y_offset) / run->scale;
+		const uz size = run->width * run->bpp;
+		memcpy(line + run->x_offset * run->bpp, run->rows + row * size, size);
+	}
+}
+
+static void _osd_update_text(us_osd_s *osd) {
+	us_osd_runtime_s *const run = osd->run;
+
+	const time_t now = time(NULL);
+	if (now == run->text_ts && run->text[0] != '\0') {
+		return;
+	}
+	run->text_ts = now;
+
+	char stamp[128] = {0};
+	struct tm tm;
+	if (localtime_r(&now, &tm) != NULL) {
+		strftime(stamp, sizeof(stamp), osd->format, &tm);
+	}
+
+	char text[sizeof(run->text)];
+	if (osd->hostname[0] != '\0') {
+		US_SNPRINTF(text, sizeof(text), "%s %s", osd->hostname, stamp);
+	} else {
+		US_SNPRINTF(text, sizeof(text), "%s", stamp);
+	}
+	if (strcmp(text, run->text)) {
+		strcpy(run->text, text);
+		run->dirty = true;
+	}
+}
+
+static void _osd_render(us_osd_s *osd) {
+	us_osd_runtime_s *const run = osd->run;
+
+	const uint scale = run->scale;
+	const uz len = strlen(run->text);
+
+	run->x_offset = scale * 2;
+	run->y_offset = scale * 2;
+	run->width = 0;
+	run->height = _FONT_ROWS * scale;
+	if (len == 0 || run->x_offset >= run->frame_width || run->y_offset + run->height > run->frame_height) {
+		return; // Nothing to draw or the frame is too small, us_osd_has_line() will return false
+	}
+	run->width = US_MIN((len * 8 + 2) * scale, run->frame_width - run->x_offset);
+
+	const uz size = _FONT_ROWS * run->width * run->bpp;
+	if (run->rows == NULL || run->rows_allocated < size) {
+		US_DELETE(run->rows, free);
+		US_CALLOC(run->rows, size);
+		run->rows_allocated = size;
+	}
+
+	// JFIF YCbCr is full range, so the text is pure white on the black box in all colorspaces
+	const bool yuv = (run->colorspace == US_OSD_YCBCR);
+	const u8 fg[3] = {0xFF, (yuv ? 0x80 : 0xFF), (yuv ? 0x80 : 0xFF)};
+	const u8 bg[3] = {0x00, (yuv ? 0x80 : 0x00), (yuv ? 0x80 : 0x00)};
+
+	u8 *ptr = run->rows;
+	for (uint row = 0; row < _FONT_ROWS; ++row) {
+		for (uint x = 0; x < run->width; ++x) {
+			bool on = false;
+			const uint font_x = x / scale;
+			if (row > 0 && row < _FONT_ROWS - 1 && font_x > 0) {
+				const uz index = (font_x - 1) / 8;
+				if (index < len) {
+					const u8 ch = US_MIN((u8)run->text[index], sizeof(US_FRAMETEXT_FONT) / 8 - 1);
+					on = (US_FRAMETEXT_FONT[ch][row - 1] >> ((font_x - 1) % 8)) & 1;
+				}
+			}
+			memcpy(ptr, (on ? fg : bg), run->bpp);
+			ptr += run->bpp;
+		}
+	}
+}
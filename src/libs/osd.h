@@ -0,0 +1,67 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2023  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#pragma once
+
+#include <time.h>
+
+#include "types.h"
+
+
+typedef enum {
+	US_OSD_RGB,
+	US_OSD_YCBCR,
+	US_OSD_GREY,
+} us_osd_colorspace_e;
+
+typedef struct {
+	char	text[256];
+	time_t	text_ts;
+	uint	frame_width;
+	uint	frame_height;
+	uint	scale;
+	uint	x_offset;	// The box is drawn from this pixel of the line...
+	uint	y_offset;	// ... and from this line of the frame
+	uint	width;		// Clipped to the frame
+	uint	height;
+	us_osd_colorspace_e colorspace;
+	uint	bpp;
+	u8		*rows;		// Pre-rendered line of the box per font row
+	uz		rows_allocated;
+	bool	dirty;
+} us_osd_runtime_s;
+
+typedef struct {
+	const char	*format; // strftime() format of the timestamp, the hostname goes before it
+	char		hostname[64];
+
+	us_osd_runtime_s *run;
+} us_osd_s;
+
+
+us_osd_s *us_osd_init(const char *format);
+void us_osd_destroy(us_osd_s *osd);
+
+void us_osd_prepare(us_osd_s *osd, uint width, uint height, us_osd_colorspace_e colorspace);
+void us_osd_apply(const us_osd_s *osd, u8 *line, uint y);
+bool us_osd_has_line(const us_osd_s *osd, uint y);
@@ -0,0 +1,120 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2023  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#include "tiles.h"
+
+#include <string.h>
+
+#include "types.h"
+#include "frame.h"
+
+
+static u64 _hash_bytes(u64 hash, const u8 *data, uz size);
+
+
+bool us_tiles_hash(const us_frame_s *frame, u64 *hashes) {
+	// Splits the raw image to the grid and hashes the bytes of each tile
+	// without any decoding. For the planar formats only the luma plane is used.
+	// Returns false for (M)JPEG and for the weird frames.
+
+	const uint bytes_per_pixel = us_get_bytes_per_pixel(frame->format);
+	if (bytes_per_pixel == 0 || frame->width < US_TILES_COLS || frame->height < US_TILES_ROWS) {
+		return false;
+	}
+	const uz stride = (frame->stride > 0 ? frame->stride : frame->width * bytes_per_pixel);
+	if (stride * frame->height > frame->used) {
+		return false;
+	}
+
+	uz col_offsets[US_TILES_COLS + 1];
+	for (uint col = 0; col <= US_TILES_COLS; ++col) {
+		col_offsets[col] = (uz)(frame->width * col / US_TILES_COLS) * bytes_per_pixel;
+	}
+
+	for (uint index = 0; index < US_TILES_COUNT; ++index) {
+		hashes[index] = 0xCBF29CE484222325ULL; // FNV offset basis
+	}
+	for (uint y = 0; y < frame->height; ++y) {
+		const u8 *const line = frame->data + y * stride;
+		u64 *const row_hashes = hashes + (y * US_TILES_ROWS / frame->height) * US_TILES_COLS;
+		for (uint col = 0; col < US_TILES_COLS; ++col) {
+			row_hashes[col] = _hash_bytes(row_hashes[col], line + col_offsets[col], col_offsets[col + 1] - col_offsets[col]);
+		}
+	}
+	return true;
+}
+
+uint us_tiles_compare(const u64 *a, const u64 *b, u8 *bitmap) {
+	// The bitmap is optional, US_TILES_COUNT / 8 bytes, row by row, LSB first
+	if (bitmap != NULL) {
+		memset(bitmap, 0, US_TILES_COUNT / 8);
+	}
+	uint changed = 0;
+	for (uint index = 0; index < US_TILES_COUNT; ++index) {
+		if (a[index] != b[index]) {
+			if (bitmap != NULL) {
+				bitmap[index / 8] |= (1 << (index % 8));
+			}
+			++changed;
+		}
+	}
+	return changed;
+}
+
+void us_tiles_map_to_hex(const u8 *bitmap, char *hex) {
+	// The hex buffer should have US_TILES_COUNT / 4 + 1 bytes
+	static const char digits[] = "0123456789abcdef";
+	for (uint index = 0; index < US_TILES_COUNT / 8; ++index) {
+		*hex++ = digits[bitmap[index] >> 4];
+		*hex++ = digits[bitmap[index] & 0xF];
+	}
+	*hex = '\0';
+}
+
+static u64 _hash_bytes(u64 hash, const u8 *data, uz size) {
+	// FNV-1a on the 64-bit words, it's enough to notice a change.
+	// Four independent lanes don't wait for each other's multiplication
+	// and are vectorized by the compiler where it's possible.
+	u64 lanes[4] = {hash, hash ^ 1, hash ^ 2, hash ^ 3};
+	uz index = 0;
+	for (; index + sizeof(lanes) <= size; index += sizeof(lanes)) {
+		u64 words[4];
+		memcpy(words, data + index, sizeof(words));
+		for (uint lane = 0; lane < 4; ++lane) {
+			lanes[lane] = (lanes[lane] ^ words[lane]) * 0x100000001B3ULL;
+		}
+	}
+	hash = lanes[0];
+	for (uint lane = 1; lane < 4; ++lane) {
+		hash = (hash ^ lanes[lane]) * 0x100000001B3ULL;
+	}
+	for (; index + sizeof(u64) <= size; index += sizeof(u64)) {
+		u64 word;
+		memcpy(&word, data + index, sizeof(u64));
+		hash = (hash ^ word) * 0x100000001B3ULL;
+	}
+	for (; index < size; ++index) {
+		hash = (hash ^ data[index]) * 0x100000001B3ULL;
+	}
+	return hash;
+}
@@ -0,0 +1,41 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2023  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#pragma once
+
+#include "types.h"
+#include "frame.h"
+
+
+#define US_TILES_COLS	16
+#define US_TILES_ROWS	16
+#define US_TILES_COUNT	(US_TILES_COLS * US_TILES_ROWS)
+
+#if US_TILES_COUNT / 8 != US_FRAME_CHANGE_MAP_SIZE
+#	error "The tiles grid doesn't match the change map of the frame"
+#endif
+
+
+bool us_tiles_hash(const us_frame_s *frame, u64 *hashes);
+uint us_tiles_compare(const u64 *a, const u64 *b, u8 *bitmap);
+void us_tiles_map_to_hex(const u8 *bitmap, char *hex);
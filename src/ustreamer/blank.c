@@ -22,6 +22,8 @@
 
 #include "blank.h"
 
+#include <string.h>
+
 #include "../libs/types.h"
 #include "../libs/tools.h"
 #include "../libs/frame.h"
@@ -36,16 +38,28 @@ us_blank_s *us_blank_init(void) {
 	blank->ft = us_frametext_init();
 	blank->raw = blank->ft->frame;
 	blank->jpeg = us_frame_init();
+	blank->h264 = us_frame_init();
 	us_blank_draw(blank, "< NO SIGNAL >", 640, 480);
 	return blank;
 }
 
 void us_blank_draw(us_blank_s *blank, const char *text, uint width, uint height) {
+	// All variants are cached by the text and the geometry,
+	// so it's cheap to call it every time when the blank is needed.
+	const us_frametext_s *const ft = blank->ft;
+	if (
+		ft->text != NULL && !strcmp(ft->text, text)
+		&& ft->frame->width == width && ft->frame->height == height
+	) {
+		return;
+	}
 	us_frametext_draw(blank->ft, text, width, height);
-	us_cpu_encoder_compress(blank->raw, blank->jpeg, 95);
+	us_cpu_encoder_compress(blank->raw, blank->jpeg, 95, NULL, NULL);
+	blank->h264->used = 0;
 }
 
 void us_blank_destroy(us_blank_s *blank) {
+	us_frame_destroy(blank->h264);
 	us_frame_destroy(blank->jpeg);
 	us_frametext_destroy(blank->ft);
 	free(blank);
@@ -31,6 +31,7 @@ typedef struct {
 	us_frametext_s	*ft;
 	us_frame_s		*raw;
 	us_frame_s		*jpeg;
+	us_frame_s		*h264; // Cached IDR, filled by the H264 stream, empty if outdated
 } us_blank_s;
 
 
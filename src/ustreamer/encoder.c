@@ -103,6 +103,12 @@ void us_encoder_open(us_encoder_s *enc, us_device_s *dev) {
 
 	if (us_is_jpeg(DR(format)) && type != US_ENCODER_TYPE_HW) {
 		US_LOG_INFO("Switching to HW encoder: the input is (M)JPEG ...");
+		if (us_cpu_encoder_has_transform(&enc->transform)) {
+			US_LOG_ERROR("The soft crop, rotation and flip are ignored: they can't be applied to (M)JPEG input");
+		}
+		if (enc->osd_format != NULL) {
+			US_LOG_ERROR("The OSD is ignored: it can't be drawn on (M)JPEG input");
+		}
 		type = US_ENCODER_TYPE_HW;
 	}
 
@@ -190,11 +196,15 @@ static void *_worker_job_init(void *v_enc) {
 	US_CALLOC(job, 1);
 	job->enc = (us_encoder_s*)v_enc;
 	job->dest = us_frame_init();
+	if (job->enc->osd_format != NULL) {
+		job->osd = us_osd_init(job->enc->osd_format);
+	}
 	return (void*)job;
 }
 
 static void _worker_job_destroy(void *v_job) {
 	us_encoder_job_s *job = v_job;
+	US_DELETE(job->osd, us_osd_destroy);
 	us_frame_destroy(job->dest);
 	free(job);
 }
@@ -208,7 +218,7 @@ static bool _worker_run_job(us_worker_s *wr) {
 	if (_ER(type) == US_ENCODER_TYPE_CPU) {
 		US_LOG_VERBOSE("Compressing JPEG using CPU: worker=%s, buffer=%u",
 			wr->name, job->hw->buf.index);
-		us_cpu_encoder_compress(src, dest, _ER(quality));
+		us_cpu_encoder_compress(src, dest, _ER(quality), &job->enc->transform, job->osd);
 
 	} else if (_ER(type) == US_ENCODER_TYPE_HW) {
 		US_LOG_VERBOSE("Compressing JPEG using HW (just copying): worker=%s, buffer=%u",
@@ -36,6 +36,7 @@
 #include "../libs/logging.h"
 #include "../libs/frame.h"
 #include "../libs/device.h"
+#include "../libs/osd.h"
 
 #include "workers.h"
 #include "m2m.h"
@@ -70,6 +71,9 @@ typedef struct {
 	us_encoder_type_e	type;
 	unsigned			n_workers;
 	char				*m2m_path;
+	char				*osd_format; // NULL to disable
+
+	us_cpu_encoder_transform_s transform;
 
 	us_encoder_runtime_s *run;
 } us_encoder_s;
@@ -78,6 +82,7 @@ typedef struct {
 	us_encoder_s	*enc;
 	us_hw_buffer_s	*hw;
 	us_frame_s		*dest;
+	us_osd_s		*osd;
 } us_encoder_job_s;
 
 
@@ -34,24 +34,47 @@ typedef struct {
 	us_frame_s	*frame;
 } _jpeg_dest_manager_s;
 
+typedef struct {
+	uint	width; // Of the encoded image
+	uint	height;
+	int		x; // Source pixel of the first pixel of the first scanline
+	int		y;
+	int		col_dx; // Source step for the next pixel of the scanline
+	int		col_dy;
+	int		row_dx; // Source step for the next scanline
+	int		row_dy;
+} _geometry_s;
+
 
 static void _jpeg_set_dest_frame(j_compress_ptr jpeg, us_frame_s *frame);
 
-static void _jpeg_write_scanlines_yuv(struct jpeg_compress_struct *jpeg, const us_frame_s *frame);
-static void _jpeg_write_scanlines_rgb565(struct jpeg_compress_struct *jpeg, const us_frame_s *frame);
-static void _jpeg_write_scanlines_rgb24(struct jpeg_compress_struct *jpeg, const us_frame_s *frame);
-static void _jpeg_write_scanlines_bgr24(struct jpeg_compress_struct *jpeg, const us_frame_s *frame);
+static void _get_geometry(const us_frame_s *frame, const us_cpu_encoder_transform_s *transform, _geometry_s *geo);
+static void _map_pixel(
+	const us_cpu_encoder_transform_s *transform,
+	uint crop_x, uint crop_y, uint crop_width, uint crop_height,
+	uint width, uint height, uint x, uint y, int *src_x, int *src_y);
+
+static void _jpeg_write_scanlines(
+	struct jpeg_compress_struct *jpeg, const us_frame_s *frame,
+	const _geometry_s *geo, const us_osd_s *osd);
+static void _convert_line(const us_frame_s *frame, uint stride, int x, int y, int dx, int dy, uint count, uint8_t *out);
 
 static void _jpeg_init_destination(j_compress_ptr jpeg);
 static boolean _jpeg_empty_output_buffer(j_compress_ptr jpeg);
 static void _jpeg_term_destination(j_compress_ptr jpeg);
 
 
-void us_cpu_encoder_compress(const us_frame_s *src, us_frame_s *dest, unsigned quality) {
+void us_cpu_encoder_compress(
+	const us_frame_s *src, us_frame_s *dest, unsigned quality,
+	const us_cpu_encoder_transform_s *transform, us_osd_s *osd) {
+
 	// This function based on compress_image_to_jpeg() from mjpg-streamer
 
 	us_frame_encoding_begin(src, dest, V4L2_PIX_FMT_JPEG);
 
+	_geometry_s geo;
+	_get_geometry(src, transform, &geo);
+
 	struct jpeg_compress_struct jpeg;
 	struct jpeg_error_mgr jpeg_error;
 
@@ -60,35 +83,49 @@ void us_cpu_encoder_compress(const us_frame_s *src, us_frame_s *dest, unsigned q
 
 	_jpeg_set_dest_frame(&jpeg, dest);
 
-	jpeg.image_width = src->width;
-	jpeg.image_height = src->height;
+	jpeg.image_width = geo.width;
+	jpeg.image_height = geo.height;
 	jpeg.input_components = 3;
+	us_osd_colorspace_e osd_colorspace;
 	switch (src->format) {
 		case V4L2_PIX_FMT_YUYV:
 		case V4L2_PIX_FMT_YVYU:
-		case V4L2_PIX_FMT_UYVY: jpeg.in_color_space = JCS_YCbCr; break;
-		default: jpeg.in_color_space = JCS_RGB; break;
+		case V4L2_PIX_FMT_UYVY:
+		case V4L2_PIX_FMT_NV12:
+		case V4L2_PIX_FMT_NV16:
+		case V4L2_PIX_FMT_YUV420:
+			jpeg.in_color_space = JCS_YCbCr;
+			osd_colorspace = US_OSD_YCBCR;
+			break;
+		case V4L2_PIX_FMT_RGB565:
+		case V4L2_PIX_FMT_RGB24:
+		case V4L2_PIX_FMT_BGR24:
+			jpeg.in_color_space = JCS_RGB;
+			osd_colorspace = US_OSD_RGB;
+			break;
+		case V4L2_PIX_FMT_GREY:
+			jpeg.input_components = 1;
+			jpeg.in_color_space = JCS_GRAYSCALE;
+			osd_colorspace = US_OSD_GREY;
+			break;
+		default: assert(0 && "Unsupported input format for CPU encoder"); return;
 	}
 
 	jpeg_set_defaults(&jpeg);
 	jpeg_set_quality(&jpeg, quality, TRUE);
 
-	jpeg_start_compress(&jpeg, TRUE);
-
-	switch (src->format) {
-		// https://www.fourcc.org/yuv.php
-		case V4L2_PIX_FMT_YUYV:
-		case V4L2_PIX_FMT_YVYU:
-		case V4L2_PIX_FMT_UYVY:		_jpeg_write_scanlines_yuv(&jpeg, src); break;
-		case V4L2_PIX_FMT_RGB565:	_jpeg_write_scanlines_rgb565(&jpeg, src); break;
-		case V4L2_PIX_FMT_RGB24:	_jpeg_write_scanlines_rgb24(&jpeg, src); break;
-		case V4L2_PIX_FMT_BGR24:	_jpeg_write_scanlines_bgr24(&jpeg, src); break;
-		default: assert(0 && "Unsupported input format for CPU encoder"); return;
+	if (osd != NULL) {
+		us_osd_prepare(osd, geo.width, geo.height, osd_colorspace);
 	}
 
+	jpeg_start_compress(&jpeg, TRUE);
+	_jpeg_write_scanlines(&jpeg, src, &geo, osd);
 	jpeg_finish_compress(&jpeg);
 	jpeg_destroy_compress(&jpeg);
 
+	dest->width = geo.width;
+	dest->height = geo.height;
+
 	us_frame_encoding_end(dest);
 }
 
@@ -108,119 +145,271 @@ static void _jpeg_set_dest_frame(j_compress_ptr jpeg, us_frame_s *frame) {
 	frame->used = 0;
 }
 
-static void _jpeg_write_scanlines_yuv(struct jpeg_compress_struct *jpeg, const us_frame_s *frame) {
-	uint8_t *line_buf;
-	US_CALLOC(line_buf, frame->width * 3);
-
-	const unsigned padding = us_frame_get_padding(frame);
-	const uint8_t *data = frame->data;
-
-	while (jpeg->next_scanline < frame->height) {
-		uint8_t *ptr = line_buf;
-
-		for (unsigned x = 0; x < frame->width; ++x) {
-			// See also: https://www.kernel.org/doc/html/v4.8/media/uapi/v4l/pixfmt-uyvy.html
-			const bool is_odd_pixel = x & 1;
-			uint8_t y, u, v;
-			if (frame->format == V4L2_PIX_FMT_YUYV) {
-				y = data[is_odd_pixel ? 2 : 0];
-				u = data[1];
-				v = data[3];
-			} else if (frame->format == V4L2_PIX_FMT_YVYU) {
-				y = data[is_odd_pixel ? 2 : 0];
-				u = data[3];
-				v = data[1];
-			} else if (frame->format == V4L2_PIX_FMT_UYVY) {
-				y = data[is_odd_pixel ? 3 : 1];
-				u = data[0];
-				v = data[2];
-			} else {
-				assert(0 && "Unsupported pixel format");
-				return; // Makes linter happy
-			}
+static void _get_geometry(const us_frame_s *frame, const us_cpu_encoder_transform_s *transform, _geometry_s *geo) {
+	// Crop, then rotate clockwise, then flip. The result is linear, so it's enough
+	// to map a few pixels of the image to get the source steps for the scanlines.
+
+	uint crop_x = 0;
+	uint crop_y = 0;
+	uint crop_width = frame->width;
+	uint crop_height = frame->height;
+	if (
+		transform != NULL && transform->crop_width > 0 && transform->crop_height > 0
+		&& transform->crop_x < frame->width && transform->crop_y < frame->height
+	) {
+		// Clip the ROI if the resolution was changed on the fly
+		crop_x = transform->crop_x;
+		crop_y = transform->crop_y;
+		crop_width = US_MIN(transform->crop_width, frame->width - crop_x);
+		crop_height = US_MIN(transform->crop_height, frame->height - crop_y);
+	}
 
-			ptr[0] = y;
-			ptr[1] = u;
-			ptr[2] = v;
-			ptr += 3;
+	const bool swap = (transform != NULL && (transform->rotate == 90 || transform->rotate == 270));
+	geo->width = (swap ? crop_height : crop_width);
+	geo->height = (swap ? crop_width : crop_height);
+
+	int next_x;
+	int next_y;
+#	define MAP(x_x, x_y, x_src_x, x_src_y) \
+		_map_pixel(transform, crop_x, crop_y, crop_width, crop_height, geo->width, geo->height, x_x, x_y, x_src_x, x_src_y)
+	MAP(0, 0, &geo->x, &geo->y);
+	MAP(1, 0, &next_x, &next_y);
+	geo->col_dx = next_x - geo->x;
+	geo->col_dy = next_y - geo->y;
+	MAP(0, 1, &next_x, &next_y);
+	geo->row_dx = next_x - geo->x;
+	geo->row_dy = next_y - geo->y;
+#	undef MAP
+}
 
-			data += (is_odd_pixel ? 4 : 0);
+static void _map_pixel(
+	const us_cpu_encoder_transform_s *transform,
+	uint crop_x, uint crop_y, uint crop_width, uint crop_height,
+	uint width, uint height, uint x, uint y, int *src_x, int *src_y) {
+
+	// The steps are calculated for 1x1 images too, just for the pixels out of the image
+	const int w = width;
+	const int h = height;
+	const int cw = crop_width;
+	const int ch = crop_height;
+	int ox = x;
+	int oy = y;
+	int sx = ox;
+	int sy = oy;
+
+	if (transform != NULL) {
+		if (transform->flip_horizontal) {
+			ox = w - 1 - ox;
+		}
+		if (transform->flip_vertical) {
+			oy = h - 1 - oy;
+		}
+		switch (transform->rotate) {
+			case 90:	sx = oy;			sy = ch - 1 - ox; break;
+			case 180:	sx = cw - 1 - ox;	sy = ch - 1 - oy; break;
+			case 270:	sx = cw - 1 - oy;	sy = ox; break;
+			default:	sx = ox;			sy = oy; break;
 		}
-		data += padding;
-
-		JSAMPROW scanlines[1] = {line_buf};
-		jpeg_write_scanlines(jpeg, scanlines, 1);
 	}
 
-	free(line_buf);
+	*src_x = (int)crop_x + sx;
+	*src_y = (int)crop_y + sy;
 }
 
-static void _jpeg_write_scanlines_rgb565(struct jpeg_compress_struct *jpeg, const us_frame_s *frame) {
-	uint8_t *line_buf;
-	US_CALLOC(line_buf, frame->width * 3);
+static void _jpeg_write_scanlines(
+	struct jpeg_compress_struct *jpeg, const us_frame_s *frame,
+	const _geometry_s *geo, const us_osd_s *osd) {
 
-	const unsigned padding = us_frame_get_padding(frame);
-	const uint8_t *data = frame->data;
+	const uint bytes_per_pixel = us_get_bytes_per_pixel(frame->format);
+	const uint stride = frame->width * bytes_per_pixel + us_frame_get_padding(frame);
 
-	while (jpeg->next_scanline < frame->height) {
-		uint8_t *ptr = line_buf;
+	// RGB24 and GREY rows which are not flipped or rotated are passed to libjpeg as is,
+	// other formats and the rows under the OSD are converted to the line buffer.
+	const bool direct = (
+		(frame->format == V4L2_PIX_FMT_RGB24 || frame->format == V4L2_PIX_FMT_GREY)
+		&& geo->col_dx == 1 && geo->col_dy == 0
+	);
 
-		for (unsigned x = 0; x < frame->width; ++x) {
-			const unsigned int two_byte = (data[1] << 8) + data[0];
-
-			ptr[0] = data[1] & 248; // Red
-			ptr[1] = (uint8_t)((two_byte & 2016) >> 3); // Green
-			ptr[2] = (data[0] & 31) * 8; // Blue
-			ptr += 3;
+	uint8_t *line_buf;
+	US_CALLOC(line_buf, geo->width * jpeg->input_components);
 
-			data += 2;
-		}
-		data += padding;
+	while (jpeg->next_scanline < geo->height) {
+		const uint line = jpeg->next_scanline;
+		const int x = geo->x + geo->row_dx * (int)line;
+		const int y = geo->y + geo->row_dy * (int)line;
+		const bool has_osd = (osd != NULL && us_osd_has_line(osd, line));
 
 		JSAMPROW scanlines[1] = {line_buf};
+		if (direct && !has_osd) {
+			scanlines[0] = frame->data + y * stride + x * bytes_per_pixel;
+		} else {
+			_convert_line(frame, stride, x, y, geo->col_dx, geo->col_dy, geo->width, line_buf);
+			if (has_osd) {
+				us_osd_apply(osd, line_buf, line);
+			}
+		}
 		jpeg_write_scanlines(jpeg, scanlines, 1);
 	}
 
 	free(line_buf);
 }
 
-static void _jpeg_write_scanlines_rgb24(struct jpeg_compress_struct *jpeg, const us_frame_s *frame) {
-	const unsigned padding = us_frame_get_padding(frame);
-	uint8_t *data = frame->data;
+static void _convert_line(const us_frame_s *frame, uint stride, int x, int y, int dx, int dy, uint count, uint8_t *out) {
+	// Converts the source pixels to the packed YCbCr, RGB24 or grayscale scanline.
+	// The forward horizontal rows are handled by the separate simple loops,
+	// so the compiler can vectorize them. The steps make the flips and rotations.
 
-	while (jpeg->next_scanline < frame->height) {
-		JSAMPROW scanlines[1] = {data};
-		jpeg_write_scanlines(jpeg, scanlines, 1);
+	const uint8_t *data = frame->data + y * stride;
+	const bool forward = (dx == 1 && dy == 0);
+	const int step = dy * (int)stride;
 
-		data += (frame->width * 3) + padding;
-	}
-}
+	switch (frame->format) {
+		// https://www.fourcc.org/yuv.php
+		// See also: https://www.kernel.org/doc/html/v4.8/media/uapi/v4l/pixfmt-uyvy.html
+		case V4L2_PIX_FMT_YUYV:
+		case V4L2_PIX_FMT_YVYU:
+		case V4L2_PIX_FMT_UYVY: {
+			uint y_offs[2] = {0, 2};
+			uint u_off = 1;
+			uint v_off = 3;
+			if (frame->format == V4L2_PIX_FMT_YVYU) {
+				u_off = 3;
+				v_off = 1;
+			} else if (frame->format == V4L2_PIX_FMT_UYVY) {
+				y_offs[0] = 1;
+				y_offs[1] = 3;
+				u_off = 0;
+				v_off = 2;
+			}
+			for (uint index = 0; index < count; ++index) {
+				const uint8_t *const pair = data + (x >> 1) * 4;
+				out[0] = pair[y_offs[x & 1]];
+				out[1] = pair[u_off];
+				out[2] = pair[v_off];
+				out += 3;
+				x += dx;
+				data += step;
+			}
+			break;
+		}
 
-static void _jpeg_write_scanlines_bgr24(struct jpeg_compress_struct *jpeg, const us_frame_s *frame) {
-	uint8_t *line_buf;
-	US_CALLOC(line_buf, frame->width * 3);
+		case V4L2_PIX_FMT_NV12:
+		case V4L2_PIX_FMT_NV16: {
+			// The Y plane is followed by the interleaved CbCr plane with the same stride
+			const uint8_t *const chroma = frame->data + stride * frame->height;
+			const uint shift = (frame->format == V4L2_PIX_FMT_NV12 ? 1 : 0); // Vertical subsampling
+			for (uint index = 0; index < count; ++index) {
+				const uint8_t *const uv = chroma + (y >> shift) * stride + (x & ~1);
+				out[0] = data[x];
+				out[1] = uv[0];
+				out[2] = uv[1];
+				out += 3;
+				x += dx;
+				y += dy;
+				data += step;
+			}
+			break;
+		}
 
-	const unsigned padding = us_frame_get_padding(frame);
-	uint8_t *data = frame->data;
+		case V4L2_PIX_FMT_YUV420: {
+			// The Y plane is followed by the Cb and Cr planes with the half of the stride and the height,
+			// rounded up for the odd sizes
+			const uint chroma_stride = (stride + 1) / 2;
+			const uint8_t *const cb = frame->data + stride * frame->height;
+			const uint8_t *const cr = cb + chroma_stride * ((frame->height + 1) / 2);
+			for (uint index = 0; index < count; ++index) {
+				const uint offset = (y >> 1) * chroma_stride + (x >> 1);
+				out[0] = data[x];
+				out[1] = cb[offset];
+				out[2] = cr[offset];
+				out += 3;
+				x += dx;
+				y += dy;
+				data += step;
+			}
+			break;
+		}
 
-	while (jpeg->next_scanline < frame->height) {
-		uint8_t *ptr = line_buf;
+		case V4L2_PIX_FMT_GREY:
+			if (forward) {
+				memcpy(out, data + x, count);
+			} else {
+				for (uint index = 0; index < count; ++index) {
+					*out = data[x];
+					++out;
+					x += dx;
+					data += step;
+				}
+			}
+			break;
+
+		case V4L2_PIX_FMT_RGB565:
+			if (forward) {
+				const uint8_t *ptr = data + x * 2;
+				for (uint index = 0; index < count; ++index) {
+					const uint two_byte = (ptr[1] << 8) + ptr[0];
+					out[0] = ptr[1] & 248; // Red
+					out[1] = (uint8_t)((two_byte & 2016) >> 3); // Green
+					out[2] = (ptr[0] & 31) * 8; // Blue
+					out += 3;
+					ptr += 2;
+				}
+			} else {
+				for (uint index = 0; index < count; ++index) {
+					const uint8_t *const ptr = data + x * 2;
+					const uint two_byte = (ptr[1] << 8) + ptr[0];
+					out[0] = ptr[1] & 248;
+					out[1] = (uint8_t)((two_byte & 2016) >> 3);
+					out[2] = (ptr[0] & 31) * 8;
+					out += 3;
+					x += dx;
+					data += step;
+				}
+			}
+			break;
 
-		// swap B and R values
-		for (unsigned x = 0; x < frame->width * 3; x += 3) {
-			ptr[0] = data[x + 2];
-			ptr[1] = data[x + 1];
-			ptr[2] = data[x];
-			ptr += 3;
-		}
-		
-		JSAMPROW scanlines[1] = {line_buf};
-		jpeg_write_scanlines(jpeg, scanlines, 1);
+		case V4L2_PIX_FMT_RGB24:
+			if (forward) {
+				memcpy(out, data + x * 3, count * 3);
+			} else {
+				for (uint index = 0; index < count; ++index) {
+					const uint8_t *const ptr = data + x * 3;
+					out[0] = ptr[0];
+					out[1] = ptr[1];
+					out[2] = ptr[2];
+					out += 3;
+					x += dx;
+					data += step;
+				}
+			}
+			break;
+
+		case V4L2_PIX_FMT_BGR24:
+			// Swap B and R values
+			if (forward) {
+				const uint8_t *ptr = data + x * 3;
+				for (uint index = 0; index < count; ++index) {
+					out[0] = ptr[2];
+					out[1] = ptr[1];
+					out[2] = ptr[0];
+					out += 3;
+					ptr += 3;
+				}
+			} else {
+				for (uint index = 0; index < count; ++index) {
+					const uint8_t *const ptr = data + x * 3;
+					out[0] = ptr[2];
+					out[1] = ptr[1];
+					out[2] = ptr[0];
+					out += 3;
+					x += dx;
+					data += step;
+				}
+			}
+			break;
 
-		data += (frame->width * 3) + padding;
+		default: assert(0 && "Unsupported pixel format");
 	}
-
-	free(line_buf);
 }
 
 #define JPEG_OUTPUT_BUFFER_SIZE ((size_t)4096)
@@ -25,14 +25,39 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <assert.h>
 
 #include <jpeglib.h>
 
 #include <linux/videodev2.h>
 
+#include "../../../libs/types.h"
 #include "../../../libs/tools.h"
 #include "../../../libs/frame.h"
-
-
-void us_cpu_encoder_compress(const us_frame_s *src, us_frame_s *dest, unsigned quality);
+#include "../../../libs/osd.h"
+
+
+typedef struct {
+	uint	crop_x;
+	uint	crop_y;
+	uint	crop_width; // Zero to disable cropping
+	uint	crop_height;
+	uint	rotate; // Clockwise: 0, 90, 180 or 270
+	bool	flip_vertical;
+	bool	flip_horizontal;
+} us_cpu_encoder_transform_s;
+
+
+static inline bool us_cpu_encoder_has_transform(const us_cpu_encoder_transform_s *transform) {
+	return (
+		transform->crop_width > 0
+		|| transform->rotate != 0
+		|| transform->flip_vertical
+		|| transform->flip_horizontal
+	);
+}
+
+void us_cpu_encoder_compress(
+	const us_frame_s *src, us_frame_s *dest, unsigned quality,
+	const us_cpu_encoder_transform_s *transform, us_osd_s *osd);
@@ -31,6 +31,7 @@
 #include "../libs/memsink.h"
 #include "../libs/unjpeg.h"
 
+#include "blank.h"
 #include "m2m.h"
 
 
@@ -69,6 +70,11 @@ void us_h264_stream_process(us_h264_stream_s *h264, const us_frame_s *frame, boo
 		h264->key_requested = false;
 		force_key = true;
 	}
+	if (h264->blank_exposed) {
+		// The encoder doesn't know that the cached blank has replaced its last frame
+		h264->blank_exposed = false;
+		force_key = true;
+	}
 
 	bool online = false;
 	if (!us_m2m_encoder_compress(h264->enc, frame, h264->dest, force_key)) {
@@ -76,3 +82,24 @@ void us_h264_stream_process(us_h264_stream_s *h264, const us_frame_s *frame, boo
 	}
 	atomic_store(&h264->online, online);
 }
+
+void us_h264_stream_process_blank(us_h264_stream_s *h264, us_blank_s *blank) {
+	// The blank is encoded only once, then the same IDR is exposed again,
+	// so the encoder doesn't produce the new forced keyframes while offline.
+	if (blank->h264->used == 0) {
+		us_h264_stream_process(h264, blank->raw, true);
+		if (atomic_load(&h264->online)) {
+			us_frame_copy(h264->dest, blank->h264);
+		}
+		return;
+	}
+
+	us_frame_s *const frame = blank->h264;
+	frame->grab_ts = us_get_now_monotonic(); // For the right RTP timestamps on the clients
+	frame->encode_begin_ts = frame->grab_ts;
+	frame->encode_end_ts = frame->grab_ts;
+	const bool online = !us_memsink_server_put(h264->sink, frame, &h264->key_requested);
+	h264->key_requested = false; // The cached blank is a keyframe anyway
+	h264->blank_exposed = true;
+	atomic_store(&h264->online, online);
+}
@@ -28,6 +28,7 @@
 #include "../libs/frame.h"
 #include "../libs/memsink.h"
 
+#include "blank.h"
 #include "m2m.h"
 
 
@@ -37,6 +38,7 @@ typedef struct {
 	us_frame_s			*tmp_src;
 	us_frame_s			*dest;
 	us_m2m_encoder_s	*enc;
+	bool				blank_exposed; // The next real frame must be a keyframe
 	atomic_bool			online;
 } us_h264_stream_s;
 
@@ -44,3 +46,4 @@ typedef struct {
 us_h264_stream_s *us_h264_stream_init(us_memsink_s *sink, const char *path, uint bitrate, uint gop);
 void us_h264_stream_destroy(us_h264_stream_s *h264);
 void us_h264_stream_process(us_h264_stream_s *h264, const us_frame_s *frame, bool force_key);
+void us_h264_stream_process_blank(us_h264_stream_s *h264, us_blank_s *blank);
@@ -0,0 +1,195 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2023  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#include "history.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include "../libs/types.h"
+#include "../libs/tools.h"
+#include "../libs/threading.h"
+#include "../libs/frame.h"
+
+
+static us_history_item_s *_history_item(us_history_s *history, uint index);
+static void _history_pop_first(us_history_s *history);
+static void _history_grow(us_history_s *history);
+
+
+us_history_s *us_history_init(uz max_size, uint max_age) {
+	us_history_runtime_s *run;
+	US_CALLOC(run, 1);
+	US_MUTEX_INIT(run->mutex);
+
+	us_history_s *history;
+	US_CALLOC(history, 1);
+	history->max_size = max_size;
+	history->max_age = max_age;
+	history->run = run;
+	return history;
+}
+
+void us_history_destroy(us_history_s *history) {
+	us_history_runtime_s *const run = history->run;
+	while (run->count > 0) {
+		_history_pop_first(history);
+	}
+	free(run->items);
+	US_MUTEX_DESTROY(run->mutex);
+	free(run);
+	free(history);
+}
+
+void us_history_put(us_history_s *history, const us_frame_s *frame, ldf ts) {
+	// The timestamp is monotonic, it's the grab_ts of the captured frames
+	// and the current time for the blank ones.
+	us_history_runtime_s *const run = history->run;
+
+	if (frame->used == 0) {
+		return;
+	}
+
+	US_MUTEX_LOCK(run->mutex);
+
+	if (run->count > 0) {
+		us_history_item_s *const last = _history_item(history, run->count - 1);
+		if (ts < last->last_ts) {
+			goto unlock; // The binary search needs the order
+		}
+		if (us_frame_compare(&last->frame, frame)) {
+			// A static screen costs nothing, the last item just covers a longer time
+			last->last_ts = ts;
+			goto unlock;
+		}
+	}
+
+	// The budget is in bytes rather than in frames, the big frames are evicted faster
+	while (run->count > 0 && (
+		run->size + frame->used > history->max_size
+		|| _history_item(history, 0)->last_ts + history->max_age < ts
+	)) {
+		_history_pop_first(history);
+	}
+	if (frame->used > history->max_size) {
+		goto unlock;
+	}
+
+	if (run->count == run->capacity) {
+		_history_grow(history);
+	}
+	us_history_item_s *const item = _history_item(history, run->count);
+	us_frame_s *const dest = &item->frame;
+	dest->data = NULL; // The memory is allocated exactly, unlike us_frame_init()
+	US_REALLOC(dest->data, frame->used);
+	memcpy(dest->data, frame->data, frame->used);
+	dest->used = frame->used;
+	dest->allocated = frame->used;
+	dest->dma_fd = -1;
+	US_FRAME_COPY_META(frame, dest);
+	item->first_ts = ts;
+	item->last_ts = ts;
+	run->size += frame->used;
+	++run->count;
+
+unlock:
+	US_MUTEX_UNLOCK(run->mutex);
+}
+
+bool us_history_find(us_history_s *history, ldf ts, us_frame_s *dest) {
+	// Returns the last frame exposed at or before the timestamp
+	us_history_runtime_s *const run = history->run;
+	bool found = false;
+
+	US_MUTEX_LOCK(run->mutex);
+	if (run->count > 0 && _history_item(history, 0)->first_ts <= ts) {
+		uint left = 0;
+		uint right = run->count - 1;
+		while (left < right) {
+			const uint middle = right - (right - left) / 2;
+			if (_history_item(history, middle)->first_ts <= ts) {
+				left = middle;
+			} else {
+				right = middle - 1;
+			}
+		}
+		us_frame_copy(&_history_item(history, left)->frame, dest);
+		found = true;
+	}
+	US_MUTEX_UNLOCK(run->mutex);
+	return found;
+}
+
+uint us_history_get_entries(us_history_s *history, us_history_entry_s **entries, uz *size) {
+	us_history_runtime_s *const run = history->run;
+
+	US_MUTEX_LOCK(run->mutex);
+	const uint count = run->count;
+	*entries = NULL;
+	if (count > 0) {
+		US_CALLOC(*entries, count);
+	}
+	for (uint index = 0; index < count; ++index) {
+		const us_history_item_s *const item = _history_item(history, index);
+		us_history_entry_s *const entry = &(*entries)[index];
+		entry->first_ts = item->first_ts;
+		entry->last_ts = item->last_ts;
+		entry->used = item->frame.used;
+		entry->width = item->frame.width;
+		entry->height = item->frame.height;
+		entry->online = item->frame.online;
+	}
+	*size = run->size;
+	US_MUTEX_UNLOCK(run->mutex);
+	return count;
+}
+
+static us_history_item_s *_history_item(us_history_s *history, uint index) {
+	const us_history_runtime_s *const run = history->run;
+	return &run->items[(run->first + index) % run->capacity];
+}
+
+static void _history_pop_first(us_history_s *history) {
+	us_history_runtime_s *const run = history->run;
+	us_history_item_s *const item = _history_item(history, 0);
+	run->size -= item->frame.used;
+	US_DELETE(item->frame.data, free);
+	run->first = (run->first + 1) % run->capacity;
+	--run->count;
+}
+
+static void _history_grow(us_history_s *history) {
+	us_history_runtime_s *const run = history->run;
+	const uint capacity = (run->capacity > 0 ? run->capacity * 2 : 64);
+	us_history_item_s *items;
+	US_CALLOC(items, capacity);
+	for (uint index = 0; index < run->count; ++index) {
+		items[index] = *_history_item(history, index);
+	}
+	free(run->items);
+	run->items = items;
+	run->capacity = capacity;
+	run->first = 0;
+}
@@ -0,0 +1,69 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2023  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#pragma once
+
+#include <pthread.h>
+
+#include "../libs/types.h"
+#include "../libs/frame.h"
+
+
+typedef struct {
+	us_frame_s	frame;
+	ldf			first_ts;
+	ldf			last_ts; // The timestamp of the last identical frame
+} us_history_item_s;
+
+typedef struct {
+	pthread_mutex_t		mutex;
+	us_history_item_s	*items; // Ring, sorted by first_ts
+	uint				capacity;
+	uint				first;
+	uint				count;
+	uz					size;
+} us_history_runtime_s;
+
+typedef struct {
+	uz		max_size;
+	uint	max_age;
+
+	us_history_runtime_s *run;
+} us_history_s;
+
+typedef struct {
+	ldf		first_ts;
+	ldf		last_ts;
+	uz		used;
+	uint	width;
+	uint	height;
+	bool	online;
+} us_history_entry_s;
+
+
+us_history_s *us_history_init(uz max_size, uint max_age);
+void us_history_destroy(us_history_s *history);
+
+void us_history_put(us_history_s *history, const us_frame_s *frame, ldf ts);
+bool us_history_find(us_history_s *history, ldf ts, us_frame_s *dest);
+uint us_history_get_entries(us_history_s *history, us_history_entry_s **entries, uz *size);
@@ -59,11 +59,13 @@
 #include "../../libs/process.h"
 #include "../../libs/frame.h"
 #include "../../libs/base64.h"
+#include "../../libs/tiles.h"
 #include "../../libs/list.h"
 #include "../data/index_html.h"
 #include "../data/favicon_ico.h"
 #include "../encoder.h"
 #include "../stream.h"
+#include "../history.h"
 #ifdef WITH_GPIO
 #	include "../gpio/gpio.h"
 #endif
@@ -87,6 +89,7 @@ static void _http_callback_favicon(struct evhttp_request *request, void *v_serve
 static void _http_callback_static(struct evhttp_request *request, void *v_server);
 static void _http_callback_state(struct evhttp_request *request, void *v_server);
 static void _http_callback_snapshot(struct evhttp_request *request, void *v_server);
+static void _http_callback_history(struct evhttp_request *request, void *v_server);
 
 static void _http_callback_stream(struct evhttp_request *request, void *v_server);
 static void _http_callback_stream_write(struct bufferevent *buf_event, void *v_ctx);
@@ -95,6 +98,8 @@ static void _http_callback_stream_error(struct bufferevent *buf_event, short wha
 static void _http_refresher(int fd, short event, void *v_server);
 static void _http_send_stream(us_server_s *server, bool stream_updated, bool frame_updated);
 static void _http_send_snapshot(us_server_s *server);
+static void _http_send_snapshot_frame(struct evhttp_request *request, const us_frame_s *frame);
+static int _http_send_history_snapshot(struct evhttp_request *request, us_server_s *server);
 
 static bool _expose_frame(us_server_s *server, const us_frame_s *frame);
 
@@ -174,6 +179,7 @@ void us_server_destroy(us_server_s *server) {
 	});
 
 	US_DELETE(run->auth_token, free);
+	US_DELETE(run->blank, us_blank_destroy);
 
 	us_frame_destroy(run->exposed->frame);
 	free(run->exposed);
@@ -196,6 +202,7 @@ int us_server_listen(us_server_s *server) {
 		}
 		assert(!evhttp_set_cb(run->http, "/state", _http_callback_state, (void*)server));
 		assert(!evhttp_set_cb(run->http, "/snapshot", _http_callback_snapshot, (void*)server));
+		assert(!evhttp_set_cb(run->http, "/history", _http_callback_history, (void*)server));
 		assert(!evhttp_set_cb(run->http, "/stream", _http_callback_stream, (void*)server));
 	}
 
@@ -505,15 +512,49 @@ static void _http_callback_state(struct evhttp_request *request, void *v_server)
 	bool online;
 	uint captured_fps;
 	us_stream_get_capture_state(stream, &width, &height, &online, &captured_fps);
+	const us_device_drops_s *const drops = &stream->dev->run->drops;
+	const us_device_bufs_stat_s *const bufs_stat = &stream->dev->run->bufs_stat;
 	_A_EVBUFFER_ADD_PRINTF(buf,
 		" \"source\": {\"resolution\": {\"width\": %u, \"height\": %u},"
-		" \"online\": %s, \"desired_fps\": %u, \"captured_fps\": %u},"
-		" \"stream\": {\"queued_fps\": %u, \"clients\": %u, \"clients_stat\": {",
+		" \"online\": %s, \"desired_fps\": %u, \"captured_fps\": %u,"
+		" \"drops\": {\"lost\": %llu, \"skipped\": %llu, \"broken\": %llu, \"truncated\": %llu, \"starved\": %llu},"
+		" \"buffers\": {\"count\": %u, \"auto\": %s, \"queued\": %u, \"queued_min\": %u, \"hold_ms\": %.3f}",
 		(server->fake_width ? server->fake_width : width),
 		(server->fake_height ? server->fake_height : height),
 		us_bool_to_string(online),
 		stream->dev->desired_fps,
 		captured_fps,
+		atomic_load(&drops->lost),
+		atomic_load(&drops->skipped),
+		atomic_load(&drops->broken),
+		atomic_load(&drops->truncated),
+		atomic_load(&drops->starved),
+		atomic_load(&bufs_stat->n_bufs),
+		us_bool_to_string(stream->dev->auto_bufs),
+		atomic_load(&bufs_stat->queued),
+		atomic_load(&bufs_stat->queued_min),
+		(double)atomic_load(&bufs_stat->hold_us) / 1000
+	);
+
+	if (stream->change_map) {
+		uint changed_tiles;
+		u8 map[US_FRAME_CHANGE_MAP_SIZE];
+		const bool mapped = us_stream_get_change_state(stream, &changed_tiles, map);
+		char map_hex[US_TILES_COUNT / 4 + 1];
+		us_tiles_map_to_hex(map, map_hex);
+		_A_EVBUFFER_ADD_PRINTF(buf,
+			", \"change\": {\"mapped\": %s, \"grid\": {\"cols\": %u, \"rows\": %u},"
+			" \"tiles\": %u, \"ratio\": %.03f, \"map\": \"%s\"}",
+			us_bool_to_string(mapped),
+			US_TILES_COLS, US_TILES_ROWS,
+			changed_tiles,
+			(double)changed_tiles / US_TILES_COUNT,
+			map_hex
+		);
+	}
+
+	_A_EVBUFFER_ADD_PRINTF(buf,
+		"}, \"stream\": {\"queued_fps\": %u, \"clients\": %u, \"clients_stat\": {",
 		ex->queued_fps,
 		run->stream_clients_count
 	);
@@ -545,6 +586,10 @@ static void _http_callback_snapshot(struct evhttp_request *request, void *v_serv
 
 	PREPROCESS_REQUEST;
 
+	if (_http_send_history_snapshot(request, server) == 0) {
+		return;
+	}
+
 	us_snapshot_client_s *client;
 	US_CALLOC(client, 1);
 	client->server = server;
@@ -555,6 +600,48 @@ static void _http_callback_snapshot(struct evhttp_request *request, void *v_serv
 	US_LIST_APPEND(server->run->snapshot_clients, client);
 }
 
+static void _http_callback_history(struct evhttp_request *request, void *v_server) {
+	us_server_s *const server = v_server;
+	us_history_s *const history = server->stream->history;
+
+	PREPROCESS_REQUEST;
+
+	if (history == NULL) {
+		evhttp_send_error(request, HTTP_NOTFOUND, "The history is disabled");
+		return;
+	}
+
+	us_history_entry_s *entries;
+	uz size;
+	const uint count = us_history_get_entries(history, &entries, &size);
+	const ldf real_offset = us_get_now_real() - us_get_now_monotonic();
+
+	struct evbuffer *buf;
+	_A_EVBUFFER_NEW(buf);
+	_A_EVBUFFER_ADD_PRINTF(buf,
+		"{\"ok\": true, \"result\": {\"size\": %zu, \"max_size\": %zu, \"max_age\": %u, \"frames\": [",
+		size, history->max_size, history->max_age);
+	for (uint index = 0; index < count; ++index) {
+		const us_history_entry_s *const entry = &entries[index];
+		_A_EVBUFFER_ADD_PRINTF(buf,
+			"{\"ts\": %.06Lf, \"last_ts\": %.06Lf, \"size\": %zu,"
+			" \"width\": %u, \"height\": %u, \"online\": %s}%s",
+			entry->first_ts + real_offset,
+			entry->last_ts + real_offset,
+			entry->used,
+			entry->width,
+			entry->height,
+			us_bool_to_string(entry->online),
+			(index + 1 < count ? ", " : ""));
+	}
+	_A_EVBUFFER_ADD_PRINTF(buf, "]}}");
+	free(entries);
+
+	_A_ADD_HEADER(request, "Content-Type", "application/json");
+	evhttp_send_reply(request, HTTP_OK, "OK", buf);
+	evbuffer_free(buf);
+}
+
 static void _http_callback_stream(struct evhttp_request *request, void *v_server) {
 	// https://github.com/libevent/libevent/blob/29cc8386a2f7911eaa9336692a2c5544d8b4734f/http.c#L2814
 	// https://github.com/libevent/libevent/blob/29cc8386a2f7911eaa9336692a2c5544d8b4734f/http.c#L2789
@@ -730,8 +817,7 @@ static void _http_callback_stream_write(struct bufferevent *buf_event, void *v_c
 				"X-UStreamer-Expose-Cmp-Time: %.06Lf" RN
 				"X-UStreamer-Expose-End-Time: %.06Lf" RN
 				"X-UStreamer-Send-Time: %.06Lf" RN
-				"X-UStreamer-Latency: %.06Lf" RN
-				RN,
+				"X-UStreamer-Latency: %.06Lf" RN,
 				us_bool_to_string(ex->frame->online),
 				ex->dropped,
 				ex->frame->width,
@@ -746,6 +832,21 @@ static void _http_callback_stream_write(struct bufferevent *buf_event, void *v_c
 				now_ts,
 				now_ts - ex->frame->grab_ts
 			);
+			if (ex->frame->change_mapped) {
+				char map_hex[US_TILES_COUNT / 4 + 1];
+				us_tiles_map_to_hex(ex->frame->change_map, map_hex);
+				_A_EVBUFFER_ADD_PRINTF(buf,
+					"X-UStreamer-Change-Grid: %ux%u" RN
+					"X-UStreamer-Change-Tiles: %u" RN
+					"X-UStreamer-Change-Ratio: %.03f" RN
+					"X-UStreamer-Change-Map: %s" RN,
+					US_TILES_COLS, US_TILES_ROWS,
+					ex->frame->changed_tiles,
+					(double)ex->frame->changed_tiles / US_TILES_COUNT,
+					map_hex
+				);
+			}
+			_A_EVBUFFER_ADD_PRINTF(buf, RN);
 		}
 	}
 
@@ -855,17 +956,7 @@ static void _http_send_stream(us_server_s *server, bool stream_updated, bool fra
 
 static void _http_send_snapshot(us_server_s *server) {
 	us_server_exposed_s *const ex = server->run->exposed;
-	us_blank_s *blank = NULL;
 
-#	define ADD_TIME_HEADER(x_key, x_value) { \
-			US_SNPRINTF(header_buf, 255, "%.06Lf", x_value); \
-			_A_ADD_HEADER(request, x_key, header_buf); \
-		}
-
-#	define ADD_UNSIGNED_HEADER(x_key, x_value) { \
-			US_SNPRINTF(header_buf, 255, "%u", x_value); \
-			_A_ADD_HEADER(request, x_key, header_buf); \
-		}
 	uint width;
 	uint height;
 	uint captured_fps; // Unused
@@ -881,47 +972,111 @@ static void _http_send_snapshot(us_server_s *server) {
 		if (has_fresh_snapshot || timed_out) {
 			us_frame_s *frame = ex->frame;
 			if (!online) {
-				if (blank == NULL) {
-					blank = us_blank_init();
-					us_blank_draw(blank, "< NO SIGNAL >", width, height);
+				if (server->run->blank == NULL) {
+					server->run->blank = us_blank_init();
 				}
-				frame = blank->jpeg;
+				us_blank_draw(server->run->blank, "< NO SIGNAL >", width, height); // Cached
+				frame = server->run->blank->jpeg;
 			}
 
-			struct evbuffer *buf;
-			_A_EVBUFFER_NEW(buf);
-			_A_EVBUFFER_ADD(buf, (const void*)frame->data, frame->used);
+			_http_send_snapshot_frame(request, frame);
 
-			_A_ADD_HEADER(request, "Cache-Control", "no-store, no-cache, must-revalidate, proxy-revalidate, pre-check=0, post-check=0, max-age=0");
-			_A_ADD_HEADER(request, "Pragma", "no-cache");
-			_A_ADD_HEADER(request, "Expires", "Mon, 3 Jan 2000 12:34:56 GMT");
-
-			char header_buf[256];
+			US_LIST_REMOVE(server->run->snapshot_clients, client);
+			free(client);
+		}
+	});
+}
 
-			ADD_TIME_HEADER("X-Timestamp", us_get_now_real());
+static void _http_send_snapshot_frame(struct evhttp_request *request, const us_frame_s *frame) {
+#	define ADD_TIME_HEADER(x_key, x_value) { \
+			US_SNPRINTF(header_buf, 255, "%.06Lf", x_value); \
+			_A_ADD_HEADER(request, x_key, header_buf); \
+		}
 
-			_A_ADD_HEADER(request, "X-UStreamer-Online",			us_bool_to_string(frame->online));
-			ADD_UNSIGNED_HEADER("X-UStreamer-Width",				frame->width);
-			ADD_UNSIGNED_HEADER("X-UStreamer-Height",				frame->height);
-			ADD_TIME_HEADER("X-UStreamer-Grab-Timestamp",			frame->grab_ts);
-			ADD_TIME_HEADER("X-UStreamer-Encode-Begin-Timestamp",	frame->encode_begin_ts);
-			ADD_TIME_HEADER("X-UStreamer-Encode-End-Timestamp",		frame->encode_end_ts);
-			ADD_TIME_HEADER("X-UStreamer-Send-Timestamp",			us_get_now_monotonic());
+#	define ADD_UNSIGNED_HEADER(x_key, x_value) { \
+			US_SNPRINTF(header_buf, 255, "%u", x_value); \
+			_A_ADD_HEADER(request, x_key, header_buf); \
+		}
 
-			_A_ADD_HEADER(request, "Content-Type", "image/jpeg");
+	struct evbuffer *buf;
+	_A_EVBUFFER_NEW(buf);
+	_A_EVBUFFER_ADD(buf, (const void*)frame->data, frame->used);
+
+	_A_ADD_HEADER(request, "Cache-Control", "no-store, no-cache, must-revalidate, proxy-revalidate, pre-check=0, post-check=0, max-age=0");
+	_A_ADD_HEADER(request, "Pragma", "no-cache");
+	_A_ADD_HEADER(request, "Expires", "Mon, 3 Jan 2000 12:34:56 GMT");
+
+	char header_buf[256];
+
+	ADD_TIME_HEADER("X-Timestamp", us_get_now_real());
+
+	_A_ADD_HEADER(request, "X-UStreamer-Online",			us_bool_to_string(frame->online));
+	ADD_UNSIGNED_HEADER("X-UStreamer-Width",				frame->width);
+	ADD_UNSIGNED_HEADER("X-UStreamer-Height",				frame->height);
+	ADD_TIME_HEADER("X-UStreamer-Grab-Timestamp",			frame->grab_ts);
+	ADD_TIME_HEADER("X-UStreamer-Encode-Begin-Timestamp",	frame->encode_begin_ts);
+	ADD_TIME_HEADER("X-UStreamer-Encode-End-Timestamp",		frame->encode_end_ts);
+	ADD_TIME_HEADER("X-UStreamer-Send-Timestamp",			us_get_now_monotonic());
+
+	if (frame->change_mapped) {
+		char map_hex[US_TILES_COUNT / 4 + 1];
+		us_tiles_map_to_hex(frame->change_map, map_hex);
+		US_SNPRINTF(header_buf, 255, "%ux%u", US_TILES_COLS, US_TILES_ROWS);
+		_A_ADD_HEADER(request, "X-UStreamer-Change-Grid", header_buf);
+		ADD_UNSIGNED_HEADER("X-UStreamer-Change-Tiles", frame->changed_tiles);
+		US_SNPRINTF(header_buf, 255, "%.03f", (double)frame->changed_tiles / US_TILES_COUNT);
+		_A_ADD_HEADER(request, "X-UStreamer-Change-Ratio", header_buf);
+		_A_ADD_HEADER(request, "X-UStreamer-Change-Map", map_hex);
+	}
 
-			evhttp_send_reply(request, HTTP_OK, "OK", buf);
-			evbuffer_free(buf);
+	_A_ADD_HEADER(request, "Content-Type", "image/jpeg");
 
-			US_LIST_REMOVE(server->run->snapshot_clients, client);
-			free(client);
-		}
-	});
+	evhttp_send_reply(request, HTTP_OK, "OK", buf);
+	evbuffer_free(buf);
 
-#	undef ADD_UNSUGNED_HEADER
+#	undef ADD_UNSIGNED_HEADER
 #	undef ADD_TIME_HEADER
+}
+
+static int _http_send_history_snapshot(struct evhttp_request *request, us_server_s *server) {
+	// Handles /snapshot?ts=<epoch> and /snapshot?ago=<sec>, returns -1 for the regular snapshot
+	int retval = -1;
 
-	US_DELETE(blank, us_blank_destroy);
+	struct evkeyvalq params;
+	evhttp_parse_query(evhttp_request_get_uri(request), &params);
+	const char *const ts_str = evhttp_find_header(&params, "ts");
+	const char *const ago_str = evhttp_find_header(&params, "ago");
+	if (ts_str == NULL && ago_str == NULL) {
+		goto done;
+	}
+	retval = 0;
+
+	char *end = NULL;
+	const ldf value = strtold((ts_str != NULL ? ts_str : ago_str), &end);
+	if (end == NULL || *end != '\0' || value < 0) {
+		evhttp_send_error(request, HTTP_BADREQUEST, "Invalid timestamp");
+		goto done;
+	}
+	if (server->stream->history == NULL) {
+		evhttp_send_error(request, HTTP_NOTFOUND, "The history is disabled");
+		goto done;
+	}
+
+	// The history is indexed by the monotonic time
+	const ldf now_ts = us_get_now_monotonic();
+	const ldf ts = (ts_str != NULL ? value - (us_get_now_real() - now_ts) : now_ts - value);
+
+	us_frame_s *const frame = us_frame_init();
+	if (us_history_find(server->stream->history, ts, frame)) {
+		_http_send_snapshot_frame(request, frame);
+	} else {
+		evhttp_send_error(request, HTTP_NOTFOUND, "No frame in the history");
+	}
+	us_frame_destroy(frame);
+
+done:
+	evhttp_clear_headers(&params);
+	return retval;
 }
 
 static void _http_refresher(int fd, short what, void *v_server) {
@@ -980,7 +1135,11 @@ static bool _expose_frame(us_server_s *server, const us_frame_s *frame) {
 		bool maybe_same = false;
 		if (
 			(need_drop = (ex->dropped < server->drop_same_frames))
-			&& (maybe_same = us_frame_compare(ex->frame, frame))
+			&& (maybe_same = (
+				// The changed tiles mean the different picture, so there is nothing to compare
+				!(frame->change_mapped && frame->changed_tiles > 0)
+				&& us_frame_compare(ex->frame, frame)
+			))
 		) {
 			ex->expose_cmp_ts = us_get_now_monotonic();
 			ex->expose_end_ts = ex->expose_cmp_ts;
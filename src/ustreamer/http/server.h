@@ -33,6 +33,7 @@
 #include "../../libs/list.h"
 #include "../encoder.h"
 #include "../stream.h"
+#include "../blank.h"
 
 
 typedef struct us_stream_client_sx {
@@ -93,6 +94,7 @@ typedef struct {
 	uint				stream_clients_count;
 
 	us_snapshot_client_s *snapshot_clients;
+	us_blank_s			*blank; // For the offline snapshots, created on demand
 } us_server_runtime_s;
 
 typedef struct us_server_sx {
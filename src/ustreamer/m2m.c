@@ -230,8 +230,22 @@ static void _m2m_encoder_ensure(us_m2m_encoder_s *enc, const us_frame_s *frame)
 		fmt.fmt.pix_mp.colorspace = V4L2_COLORSPACE_JPEG; // libcamera currently has no means to request the right colour space
 		fmt.fmt.pix_mp.num_planes = 1;
 		// fmt.fmt.pix_mp.plane_fmt[0].bytesperline = run->p_stride;
+		const bool planar = (
+			run->p_input_format == V4L2_PIX_FMT_NV12
+			|| run->p_input_format == V4L2_PIX_FMT_NV16
+			|| run->p_input_format == V4L2_PIX_FMT_YUV420
+		);
+		if (planar) {
+			// The chroma planes are located by the stride, so it must match the captured frames
+			fmt.fmt.pix_mp.plane_fmt[0].bytesperline = run->p_stride;
+		}
 		_E_LOG_DEBUG("Configuring INPUT format ...");
 		_E_XIOCTL(VIDIOC_S_FMT, &fmt, "Can't set INPUT format");
+		if (planar && fmt.fmt.pix_mp.plane_fmt[0].bytesperline != run->p_stride) {
+			_E_LOG_ERROR("The INPUT stride can't be configured as %u, the encoder wants %u",
+				run->p_stride, fmt.fmt.pix_mp.plane_fmt[0].bytesperline);
+			goto error;
+		}
 	}
 
 	{
@@ -454,6 +468,11 @@ static int _m2m_encoder_compress_raw(us_m2m_encoder_s *enc, const us_frame_s *sr
 		input_plane.m.fd = src->dma_fd;
 		_E_LOG_DEBUG("Using INPUT-DMA buffer=%u", input_buf.index);
 	} else {
+		if (src->used > run->input_bufs[0].allocated) { // All of the INPUT buffers have the same size
+			_E_LOG_ERROR("The frame is too big for the INPUT buffer: %zu > %zu",
+				src->used, run->input_bufs[0].allocated);
+			goto error;
+		}
 		input_buf.memory = V4L2_MEMORY_MMAP;
 		_E_LOG_DEBUG("Grabbing INPUT buffer ...");
 		_E_XIOCTL(VIDIOC_DQBUF, &input_buf, "Can't grab INPUT buffer");
@@ -61,7 +61,16 @@ enum _US_OPT_VALUES {
 
 	_O_DEVICE_TIMEOUT = 10000,
 	_O_DEVICE_ERROR_DELAY,
+	_O_COPY_ON_PRESSURE,
+	_O_CHANGE_MAP,
+	_O_DMA_HEAP,
+	_O_JPEG_CHECK,
 	_O_M2M_DEVICE,
+	_O_OSD,
+	_O_SOFT_CROP,
+	_O_SOFT_ROTATE,
+	_O_SOFT_FLIP_VERTICAL,
+	_O_SOFT_FLIP_HORIZONTAL,
 
 	_O_IMAGE_DEFAULT,
 	_O_BRIGHTNESS,
@@ -85,6 +94,11 @@ enum _US_OPT_VALUES {
 	_O_INSTANCE_ID,
 	_O_TCP_NODELAY,
 	_O_SERVER_TIMEOUT,
+	_O_HISTORY_SIZE,
+	_O_HISTORY_TIME,
+	_O_RECORD,
+	_O_RECORD_INTERVAL,
+	_O_RECORD_THRESHOLD,
 
 #	define ADD_SINK(x_prefix) \
 		_O_##x_prefix, \
@@ -148,7 +162,16 @@ static const struct option _LONG_OPTS[] = {
 	{"slowdown",				no_argument,		NULL,	_O_SLOWDOWN},
 	{"device-timeout",			required_argument,	NULL,	_O_DEVICE_TIMEOUT},
 	{"device-error-delay",		required_argument,	NULL,	_O_DEVICE_ERROR_DELAY},
+	{"copy-on-pressure",		required_argument,	NULL,	_O_COPY_ON_PRESSURE},
+	{"change-map",				no_argument,		NULL,	_O_CHANGE_MAP},
+	{"dma-heap",				required_argument,	NULL,	_O_DMA_HEAP},
+	{"jpeg-check",				no_argument,		NULL,	_O_JPEG_CHECK},
 	{"m2m-device",				required_argument,	NULL,	_O_M2M_DEVICE},
+	{"osd",						required_argument,	NULL,	_O_OSD},
+	{"soft-crop",				required_argument,	NULL,	_O_SOFT_CROP},
+	{"soft-rotate",				required_argument,	NULL,	_O_SOFT_ROTATE},
+	{"soft-flip-vertical",		no_argument,		NULL,	_O_SOFT_FLIP_VERTICAL},
+	{"soft-flip-horizontal",	no_argument,		NULL,	_O_SOFT_FLIP_HORIZONTAL},
 
 	{"image-default",			no_argument,		NULL,	_O_IMAGE_DEFAULT},
 	{"brightness",				required_argument,	NULL,	_O_BRIGHTNESS},
@@ -182,6 +205,11 @@ static const struct option _LONG_OPTS[] = {
 	{"fake-resolution",			required_argument,	NULL,	_O_FAKE_RESOLUTION},
 	{"tcp-nodelay",				no_argument,		NULL,	_O_TCP_NODELAY},
 	{"server-timeout",			required_argument,	NULL,	_O_SERVER_TIMEOUT},
+	{"history-size",			required_argument,	NULL,	_O_HISTORY_SIZE},
+	{"history-time",			required_argument,	NULL,	_O_HISTORY_TIME},
+	{"record",					required_argument,	NULL,	_O_RECORD},
+	{"record-interval",			required_argument,	NULL,	_O_RECORD_INTERVAL},
+	{"record-threshold",		required_argument,	NULL,	_O_RECORD_THRESHOLD},
 
 #	define ADD_SINK(x_opt, x_prefix) \
 		{x_opt "-sink",				required_argument,	NULL,	_O_##x_prefix}, \
@@ -237,6 +265,8 @@ static const struct option _LONG_OPTS[] = {
 
 
 static int _parse_resolution(const char *str, unsigned *width, unsigned *height, bool limited);
+static int _parse_crop(const char *str, us_cpu_encoder_transform_s *transform);
+static int _parse_rotate(const char *str);
 static int _check_instance_id(const char *str);
 
 static void _features(void);
@@ -260,6 +290,8 @@ void us_options_destroy(us_options_s *options) {
 	US_DELETE(options->jpeg_sink, us_memsink_destroy);
 	US_DELETE(options->raw_sink, us_memsink_destroy);
 	US_DELETE(options->h264_sink, us_memsink_destroy);
+	US_DELETE(options->history, us_history_destroy);
+	US_DELETE(options->recorder, us_recorder_destroy);
 
 	for (unsigned index = 0; index < options->argc; ++index) {
 		free(options->argv_copy[index]);
@@ -350,6 +382,13 @@ int options_parse(us_options_s *options, us_device_s *dev, us_encoder_s *enc, us
 	ADD_SINK(h264_sink);
 #	undef ADD_SINK
 
+	uint history_size = 0;
+	uint history_time = 30;
+
+	const char *record_path = NULL;
+	uint record_interval = 60;
+	uint record_threshold = 0;
+
 #	ifdef WITH_SETPROCTITLE
 	char *process_name_prefix = NULL;
 #	endif
@@ -372,7 +411,12 @@ int options_parse(us_options_s *options, us_device_s *dev, us_encoder_s *enc, us
 			case _O_MIN_FRAME_SIZE:		OPT_NUMBER("--min-frame-size", dev->min_frame_size, 1, 8192, 0);
 			case _O_PERSISTENT:			OPT_SET(dev->persistent, true);
 			case _O_DV_TIMINGS:			OPT_SET(dev->dv_timings, true);
-			case _O_BUFFERS:			OPT_NUMBER("--buffers", dev->n_bufs, 1, 32, 0);
+			case _O_BUFFERS:
+				if (!strcasecmp(optarg, "auto")) {
+					OPT_SET(dev->auto_bufs, true);
+				}
+				dev->auto_bufs = false;
+				OPT_NUMBER("--buffers", dev->n_bufs, 1, 32, 0);
 			case _O_WORKERS:			OPT_NUMBER("--workers", enc->n_workers, 1, 32, 0);
 			case _O_QUALITY:			OPT_NUMBER("--quality", dev->jpeg_quality, 1, 100, 0);
 			case _O_ENCODER:			OPT_PARSE_ENUM("encoder type", enc->type, us_encoder_parse_type, ENCODER_TYPES_STR);
@@ -382,7 +426,21 @@ int options_parse(us_options_s *options, us_device_s *dev, us_encoder_s *enc, us
 			case _O_SLOWDOWN:			OPT_SET(stream->slowdown, true);
 			case _O_DEVICE_TIMEOUT:		OPT_NUMBER("--device-timeout", dev->timeout, 1, 60, 0);
 			case _O_DEVICE_ERROR_DELAY:	OPT_NUMBER("--device-error-delay", stream->error_delay, 1, 60, 0);
+			case _O_COPY_ON_PRESSURE:	OPT_NUMBER("--copy-on-pressure", stream->copy_on_pressure, 0, 32, 0);
+			case _O_CHANGE_MAP:			OPT_SET(stream->change_map, true);
+			case _O_DMA_HEAP:			OPT_SET(dev->dma_heap_path, optarg);
+			case _O_JPEG_CHECK:			OPT_SET(dev->jpeg_check, true);
 			case _O_M2M_DEVICE:			OPT_SET(enc->m2m_path, optarg);
+			case _O_OSD:				OPT_SET(enc->osd_format, optarg);
+			case _O_SOFT_CROP:
+				if (_parse_crop(optarg, &enc->transform) < 0) {
+					printf("Invalid crop format for '--soft-crop=%s', it should be WxH+X+Y\n", optarg);
+					return -1;
+				}
+				break;
+			case _O_SOFT_ROTATE:		OPT_PARSE_ENUM("rotation", enc->transform.rotate, _parse_rotate, "0, 90, 180, 270");
+			case _O_SOFT_FLIP_VERTICAL:		OPT_SET(enc->transform.flip_vertical, true);
+			case _O_SOFT_FLIP_HORIZONTAL:	OPT_SET(enc->transform.flip_horizontal, true);
 
 			case _O_IMAGE_DEFAULT:
 				OPT_CTL_DEFAULT_NOBREAK(brightness);
@@ -436,6 +494,12 @@ int options_parse(us_options_s *options, us_device_s *dev, us_encoder_s *enc, us
 				break;
 			case _O_TCP_NODELAY:		OPT_SET(server->tcp_nodelay, true);
 			case _O_SERVER_TIMEOUT:		OPT_NUMBER("--server-timeout", server->timeout, 1, 60, 0);
+			case _O_HISTORY_SIZE:		OPT_NUMBER("--history-size", history_size, 0, 4096, 0);
+			case _O_HISTORY_TIME:		OPT_NUMBER("--history-time", history_time, 1, 3600, 0);
+
+			case _O_RECORD:				OPT_SET(record_path, optarg);
+			case _O_RECORD_INTERVAL:	OPT_NUMBER("--record-interval", record_interval, 1, 86400, 0);
+			case _O_RECORD_THRESHOLD:	OPT_NUMBER("--record-threshold", record_threshold, 0, 100, 0);
 
 #			define ADD_SINK(x_opt, x_lp, x_up) \
 				case _O_##x_up:					OPT_SET(x_lp##_name, optarg); \
@@ -488,6 +552,21 @@ int options_parse(us_options_s *options, us_device_s *dev, us_encoder_s *enc, us
 		}
 	}
 
+	if (us_cpu_encoder_has_transform(&enc->transform) && enc->type != US_ENCODER_TYPE_CPU) {
+		// Only the CPU encoder applies them, the others would silently ignore them
+		printf("The '--soft-crop', '--soft-rotate' and '--soft-flip-*' work with '--encoder=CPU' only\n");
+		return -1;
+	}
+	if (enc->osd_format != NULL && enc->type != US_ENCODER_TYPE_CPU) {
+		printf("The '--osd' works with '--encoder=CPU' only\n");
+		return -1;
+	}
+	if (stream->change_map && us_cpu_encoder_has_transform(&enc->transform)) {
+		// The map is built from the captured frames and wouldn't match the transformed JPEGs
+		printf("The '--change-map' can't be used with '--soft-crop', '--soft-rotate' and '--soft-flip-*'\n");
+		return -1;
+	}
+
 	US_LOG_INFO("Starting PiKVM uStreamer %s ...", US_VERSION);
 
 #	define ADD_SINK(x_label, x_prefix) { \
@@ -509,6 +588,22 @@ int options_parse(us_options_s *options, us_device_s *dev, us_encoder_s *enc, us
 	ADD_SINK("H264", h264_sink);
 #	undef ADD_SINK
 
+	if (enc->osd_format != NULL && stream->h264_sink != NULL) {
+		US_LOG_ERROR("The OSD is drawn on the JPEG frames only, the H264 sink isn't stamped");
+	}
+
+	if (history_size > 0) {
+		options->history = us_history_init((uz)history_size * 1024 * 1024, history_time);
+		stream->history = options->history;
+	}
+
+	if (record_path != NULL) {
+		if ((options->recorder = us_recorder_init(record_path, record_interval, record_threshold)) == NULL) {
+			return -1;
+		}
+		stream->recorder = options->recorder;
+	}
+
 #	ifdef WITH_SETPROCTITLE
 	if (process_name_prefix != NULL) {
 		us_process_set_name_prefix(options->argc, options->argv, process_name_prefix);
@@ -544,6 +639,34 @@ static int _parse_resolution(const char *str, unsigned *width, unsigned *height,
 	return 0;
 }
 
+static int _parse_crop(const char *str, us_cpu_encoder_transform_s *transform) {
+	unsigned tmp_width;
+	unsigned tmp_height;
+	unsigned tmp_x;
+	unsigned tmp_y;
+	int end = 0;
+	if (sscanf(str, "%ux%u+%u+%u%n", &tmp_width, &tmp_height, &tmp_x, &tmp_y, &end) != 4 || str[end] != '\0') {
+		return -1;
+	}
+	if (tmp_width == 0 || tmp_height == 0) {
+		return -1;
+	}
+	transform->crop_width = tmp_width;
+	transform->crop_height = tmp_height;
+	transform->crop_x = tmp_x;
+	transform->crop_y = tmp_y;
+	return 0;
+}
+
+static int _parse_rotate(const char *str) {
+	char *end = NULL;
+	const long value = strtol(str, &end, 10);
+	if (*str == '\0' || *end != '\0' || (value != 0 && value != 90 && value != 180 && value != 270)) {
+		return -1;
+	}
+	return value;
+}
+
 static int _check_instance_id(const char *str) {
 	for (const char *ptr = str; *ptr; ++ptr) {
 		if (!(isascii(*ptr) && (
@@ -605,15 +728,24 @@ static void _help(FILE *fp, const us_device_s *dev, const us_encoder_s *enc, con
 	SAY("                                           Available: %s; default: disabled.\n", US_STANDARDS_STR);
 	SAY("    -I|--io-method <method>  ───────────── Set V4L2 IO method (see kernel documentation).");
 	SAY("                                           Changing of this parameter may increase the performance. Or not.");
+	SAY("                                           DMABUF allocates the buffers from a DMA heap, they are shared");
+	SAY("                                           with the M2M encoder without copying and survive the reopening.");
 	SAY("                                           Available: %s; default: MMAP.\n", US_IO_METHODS_STR);
+	SAY("    --dma-heap </dev/path>  ────────────── DMA heap for --io-method=DMABUF.");
+	SAY("                                           Default: /dev/dma_heap/linux,cma or /dev/dma_heap/system.\n");
 	SAY("    -f|--desired-fps <N>  ──────────────── Desired FPS. Default: maximum possible.\n");
 	SAY("    -z|--min-frame-size <N>  ───────────── Drop frames smaller then this limit. Useful if the device");
 	SAY("                                           produces small-sized garbage frames. Default: %zu bytes.\n", dev->min_frame_size);
+	SAY("    --jpeg-check  ──────────────────────── Drop (M)JPEG frames with broken markers structure. By default");
+	SAY("                                           only the end of the frame is checked. Default: disabled.\n");
 	SAY("    -n|--persistent  ───────────────────── Don't re-initialize device on timeout. Default: disabled.\n");
 	SAY("    -t|--dv-timings  ───────────────────── Enable DV-timings querying and events processing");
 	SAY("                                           to automatic resolution change. Default: disabled.\n");
 	SAY("    -b|--buffers <N>  ──────────────────── The number of buffers to receive data from the device.");
 	SAY("                                           Each buffer may processed using an independent thread.");
+	SAY("                                           The value \"auto\" starts with the default and sizes the buffers");
+	SAY("                                           from the time they are held by the consumers and the source FPS,");
+	SAY("                                           the device is reopened if it's running out of them.");
 	SAY("                                           Default: %u (the number of CPU cores (but not more than 4) + 1).\n", dev->n_bufs);
 	SAY("    -w|--workers <N>  ──────────────────── The number of worker threads but not more than buffers.");
 	SAY("                                           Default: %u (the number of CPU cores (but not more than 4)).\n", enc->n_workers);
@@ -638,7 +770,32 @@ static void _help(FILE *fp, const us_device_s *dev, const us_encoder_s *enc, con
 	SAY("    --device-timeout <sec>  ────────────── Timeout for device querying. Default: %u.\n", dev->timeout);
 	SAY("    --device-error-delay <sec>  ────────── Delay before trying to connect to the device again");
 	SAY("                                           after an error (timeout for example). Default: %u.\n", stream->error_delay);
+	SAY("    --copy-on-pressure <N>  ────────────── When less than N buffers are left in the driver, the H264 and RAW");
+	SAY("                                           sinks switch to copying the frames and give the buffers back");
+	SAY("                                           immediately, so they don't hold back the capturing and the JPEG");
+	SAY("                                           stream. The copying lasts until the device is reopened.");
+	SAY("                                           Default: %u (disabled).\n", stream->copy_on_pressure);
+	SAY("    --change-map  ──────────────────────── Hash the captured frames on the 16x16 grid of tiles and attach");
+	SAY("                                           the map of the changed tiles to the frames of the sinks,");
+	SAY("                                           to the X-UStreamer-Change-* headers and to /state, so the clients");
+	SAY("                                           can skip the unchanged frames. Doesn't work for (M)JPEG sources");
+	SAY("                                           and can't be used with --soft-crop, --soft-rotate and --soft-flip-*.");
+	SAY("                                           Default: disabled.\n");
 	SAY("    --m2m-device </dev/path>  ──────────── Path to V4L2 M2M encoder device. Default: auto select.\n");
+	SAY("    --osd <fmt>  ───────────────────────── Draw the hostname and the wall-clock time in strftime() format");
+	SAY("                                           over the top-left corner of the frames, for example \"%%F %%T\".");
+	SAY("                                           Works with the CPU encoder only and not for (M)JPEG sources,");
+	SAY("                                           the H264 sink isn't stamped. Default: disabled.\n");
+	SAY("    --soft-crop <WxH+X+Y>  ─────────────── Encode only this region of the frame. It reduces the CPU usage");
+	SAY("                                           unlike the cropping on the client side. Works with the CPU encoder");
+	SAY("                                           only and not for (M)JPEG sources. Default: disabled.\n");
+	SAY("    --soft-rotate <deg>  ───────────────── Rotate the image clockwise by 0, 90, 180 or 270 degrees in software,");
+	SAY("                                           for the devices which ignore --rotate. Works with the CPU encoder");
+	SAY("                                           only and not for (M)JPEG sources. Default: 0.\n");
+	SAY("    --soft-flip-vertical  ──────────────── Flip the image vertically in software. Works with the CPU encoder");
+	SAY("                                           only and not for (M)JPEG sources. Default: disabled.\n");
+	SAY("    --soft-flip-horizontal  ────────────── Flip the image horizontally in software. Works with the CPU encoder");
+	SAY("                                           only and not for (M)JPEG sources. Default: disabled.\n");
 	SAY("Image control options:");
 	SAY("══════════════════════");
 	SAY("    --image-default  ────────────────────── Reset all image settings below to default. Default: no change.\n");
@@ -681,6 +838,10 @@ static void _help(FILE *fp, const us_device_s *dev, const us_encoder_s *enc, con
 	SAY("    --instance-id <str>  ──────── A short string identifier to be displayed in the /state handle.");
 	SAY("                                  It must satisfy regexp ^[a-zA-Z0-9\\./+_-]*$. Default: an empty string.\n");
 	SAY("    --server-timeout <sec>  ───── Timeout for client connections. Default: %u.\n", server->timeout);
+	SAY("    --history-size <MB>  ──────── Keep the recent JPEG frames in memory within this budget to serve");
+	SAY("                                  /snapshot?ts=<epoch>, /snapshot?ago=<sec> and /history.");
+	SAY("                                  The identical frames are stored once. Default: disabled.\n");
+	SAY("    --history-time <sec>  ─────── Drop the frames older than this from the history. Default: 30.\n");
 #	define ADD_SINK(x_name, x_opt) \
 		SAY(x_name " sink options:"); \
 		SAY("══════════════════"); \
@@ -698,6 +859,17 @@ static void _help(FILE *fp, const us_device_s *dev, const us_encoder_s *enc, con
 	SAY("    --h264-bitrate <kbps>  ───────── H264 bitrate in Kbps. Default: %u.\n", stream->h264_bitrate);
 	SAY("    --h264-gop <N>  ──────────────── Interval between keyframes. Default: %u.\n", stream->h264_gop);
 	SAY("    --h264-m2m-device </dev/path>  ─ Path to V4L2 M2M encoder device. Default: auto select.\n");
+	SAY("Recording options:");
+	SAY("══════════════════");
+	SAY("    --record <path>  ──────────── Append the JPEG frames to this file and its index <path>.idx");
+	SAY("                                  when the picture was changed or the interval is over.");
+	SAY("                                  The changes are found by the hashing of the raw frames, so");
+	SAY("                                  JPEG is encoded only for the recorded frames. Default: disabled.\n");
+	SAY("    --record-interval <sec>  ──── Record a frame at least this often. For (M)JPEG sources");
+	SAY("                                  the changes are not detected, only the interval is used.");
+	SAY("                                  Default: 60.\n");
+	SAY("    --record-threshold <%%>  ───── Percent of the changed areas of 16x16 grid to record a frame.");
+	SAY("                                  Default: 0 (any change).\n");
 #	ifdef WITH_GPIO
 	SAY("GPIO options:");
 	SAY("═════════════");
@@ -43,6 +43,8 @@
 
 #include "encoder.h"
 #include "stream.h"
+#include "history.h"
+#include "recorder.h"
 #include "http/server.h"
 #ifdef WITH_GPIO
 #	include "gpio/gpio.h"
@@ -56,6 +58,8 @@ typedef struct {
 	us_memsink_s	*jpeg_sink;
 	us_memsink_s	*raw_sink;
 	us_memsink_s	*h264_sink;
+	us_history_s	*history;
+	us_recorder_s	*recorder;
 } us_options_s;
 
 
@@ -0,0 +1,311 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2023  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#include "recorder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <sys/types.h>
+
+#include "../libs/types.h"
+#include "../libs/tools.h"
+#include "../libs/logging.h"
+#include "../libs/frame.h"
+#include "../libs/tiles.h"
+
+
+#define _DATA_BUF_SIZE	((uz)4 * 1024 * 1024)
+#define _MAX_INDEXES	((uint)2048)
+#define _CHECK_INTERVAL	((ldf)0.5)
+#define _FLUSH_INTERVAL	((ldf)10)
+
+
+static FILE *_recorder_open_file(const char *path, char **buf, uz buf_size, u64 *size);
+static void _recorder_write(us_recorder_s *rec, const us_frame_s *jpeg);
+static void _recorder_flush(us_recorder_s *rec);
+static void _recorder_resync(us_recorder_s *rec);
+
+
+us_recorder_s *us_recorder_init(const char *path, uint interval, uint threshold) {
+	us_recorder_runtime_s *run;
+	US_CALLOC(run, 1);
+	run->index_fd = -1;
+	US_CALLOC(run->indexes, _MAX_INDEXES);
+	run->jpeg = us_frame_init();
+	atomic_init(&run->state, US_RECORDER_IDLE);
+	atomic_init(&run->requested_ts, 0);
+
+	us_recorder_s *rec;
+	US_CALLOC(rec, 1);
+	rec->path = us_strdup(path);
+	rec->interval = interval;
+	rec->threshold = threshold;
+	rec->run = run;
+
+	const uz index_path_size = strlen(path) + 8;
+	char *index_path;
+	US_CALLOC(index_path, index_path_size);
+	US_SNPRINTF(index_path, index_path_size, "%s.idx", path);
+
+	US_LOG_INFO("REC: Recording to %s and %s ...", path, index_path);
+	if ((run->data_file = _recorder_open_file(path, &run->data_buf, _DATA_BUF_SIZE, &run->offset)) == NULL) {
+		goto error;
+	}
+	if ((run->index_fd = open(index_path, O_WRONLY | O_CREAT | O_APPEND, 0666)) < 0) {
+		US_LOG_PERROR("REC: Can't open %s", index_path);
+		goto error;
+	}
+	free(index_path);
+	run->flush_ts = us_get_now_monotonic();
+	return rec;
+
+error:
+	free(index_path);
+	us_recorder_destroy(rec);
+	return NULL;
+}
+
+void us_recorder_destroy(us_recorder_s *rec) {
+	us_recorder_runtime_s *const run = rec->run;
+	if (atomic_load(&run->state) == US_RECORDER_READY) {
+		_recorder_write(rec, run->jpeg);
+	}
+	_recorder_flush(rec);
+	US_DELETE(run->data_file, fclose);
+	US_CLOSE_FD(run->index_fd);
+	free(run->data_buf);
+	free(run->indexes);
+	us_frame_destroy(run->jpeg);
+	free(run);
+	free(rec->path);
+	free(rec);
+}
+
+void us_recorder_check(us_recorder_s *rec, const us_frame_s *raw) {
+	// Called by the REC stage for the captured frames. A frame is requested
+	// from the JPEG encoder if enough tiles were changed since the last recorded one
+	// or if the interval is over. For (M)JPEG sources only the interval is used.
+	// The file writes are also done here to keep them away from the JPEG stage.
+	us_recorder_runtime_s *const run = rec->run;
+
+	const uint state = atomic_load(&run->state);
+	if (state == US_RECORDER_READY) {
+		_recorder_write(rec, run->jpeg);
+		atomic_store(&run->state, US_RECORDER_IDLE);
+		if (run->flush_ts + _FLUSH_INTERVAL < us_get_now_monotonic()) {
+			_recorder_flush(rec);
+		}
+	} else if (state == US_RECORDER_REQUESTED) {
+		return;
+	}
+	if (run->data_file == NULL) {
+		return; // Stopped after an unrecoverable write error
+	}
+
+	const ldf now_ts = us_get_now_monotonic();
+	if (now_ts < run->last_check_ts + _CHECK_INTERVAL) {
+		return;
+	}
+	run->last_check_ts = now_ts;
+
+	bool changed = false;
+	if (
+		!run->has_last
+		|| run->last_width != raw->width
+		|| run->last_height != raw->height
+		|| run->last_format != raw->format
+	) {
+		changed = true;
+		if (!us_tiles_hash(raw, run->hashes)) {
+			memset(run->hashes, 0, sizeof(run->hashes));
+		}
+	} else if (us_tiles_hash(raw, run->hashes)) {
+		const uint tiles = us_tiles_compare(run->hashes, run->last_hashes, NULL);
+		changed = (tiles > 0 && tiles * 100 >= rec->threshold * US_TILES_COUNT);
+	}
+
+	if (changed || run->last_request_ts + rec->interval <= now_ts) {
+		memcpy(run->last_hashes, run->hashes, sizeof(run->hashes));
+		run->has_last = true;
+		run->last_width = raw->width;
+		run->last_height = raw->height;
+		run->last_format = raw->format;
+		run->last_request_ts = now_ts;
+		atomic_store(&run->requested_ts, (u64)(raw->grab_ts * 1000000));
+		atomic_store(&run->state, US_RECORDER_REQUESTED);
+		US_LOG_VERBOSE("REC: Requested a frame: changed=%d", changed);
+	}
+}
+
+bool us_recorder_is_requested(us_recorder_s *rec) {
+	return (atomic_load(&rec->run->state) == US_RECORDER_REQUESTED);
+}
+
+void us_recorder_put_jpeg(us_recorder_s *rec, const us_frame_s *jpeg) {
+	// Called by the JPEG stage for the encoded frames, the first one
+	// which was grabbed after the request is copied for the REC stage.
+	us_recorder_runtime_s *const run = rec->run;
+	if (
+		atomic_load(&run->state) != US_RECORDER_REQUESTED
+		|| (u64)(jpeg->grab_ts * 1000000) < atomic_load(&run->requested_ts)
+	) {
+		return;
+	}
+	us_frame_copy(jpeg, run->jpeg);
+	atomic_store(&run->state, US_RECORDER_READY);
+}
+
+static FILE *_recorder_open_file(const char *path, char **buf, uz buf_size, u64 *size) {
+	FILE *file = fopen(path, "ab");
+	if (file == NULL) {
+		US_LOG_PERROR("REC: Can't open %s", path);
+		return NULL;
+	}
+	// The big buffer turns the small records into the rare large writes
+	US_CALLOC(*buf, buf_size);
+	if (setvbuf(file, *buf, _IOFBF, buf_size) != 0) {
+		US_LOG_PERROR("REC: Can't set the buffer for %s", path);
+		goto error;
+	}
+	if (fseeko(file, 0, SEEK_END) < 0) {
+		US_LOG_PERROR("REC: Can't seek %s", path);
+		goto error;
+	}
+	const off_t offset = ftello(file);
+	if (offset < 0) {
+		US_LOG_PERROR("REC: Can't get the size of %s", path);
+		goto error;
+	}
+	*size = offset;
+	return file;
+
+error:
+	fclose(file);
+	US_DELETE(*buf, free);
+	return NULL;
+}
+
+static void _recorder_write(us_recorder_s *rec, const us_frame_s *jpeg) {
+	us_recorder_runtime_s *const run = rec->run;
+	if (run->data_file == NULL) {
+		return;
+	}
+
+	const u64 ts = US_MAX(run->last_ts, (u64)((us_get_now_real() - us_get_now_monotonic() + jpeg->grab_ts) * 1000000));
+	const us_recorder_header_s header = {
+		.magic = US_RECORDER_MAGIC,
+		.size = jpeg->used,
+		.ts = ts,
+		.width = jpeg->width,
+		.height = jpeg->height,
+	};
+	const us_recorder_index_s index = {
+		.ts = ts,
+		.offset = run->offset,
+		.size = jpeg->used,
+		.width = jpeg->width,
+		.height = jpeg->height,
+	};
+	if (
+		fwrite(&header, sizeof(header), 1, run->data_file) != 1
+		|| fwrite(jpeg->data, jpeg->used, 1, run->data_file) != 1
+	) {
+		US_LOG_PERROR("REC: Can't write the frame to %s", rec->path);
+		_recorder_resync(rec);
+		return;
+	}
+	run->offset += sizeof(header) + jpeg->used;
+	run->last_ts = ts;
+	run->indexes[run->n_indexes] = index;
+	++run->n_indexes;
+	if (run->n_indexes >= _MAX_INDEXES) {
+		_recorder_flush(rec);
+	}
+	US_LOG_VERBOSE("REC: Written a frame: size=%zu, offset=%" PRIu64, jpeg->used, index.offset);
+}
+
+static void _recorder_flush(us_recorder_s *rec) {
+	// The index entries are kept in memory and written only after the data is flushed,
+	// so the index never points beyond the data file. The stdio buffer can't guarantee it,
+	// because it's written out by itself when it's full.
+	us_recorder_runtime_s *const run = rec->run;
+	run->flush_ts = us_get_now_monotonic();
+	if (run->data_file == NULL || run->index_fd < 0) {
+		return;
+	}
+	if (fflush(run->data_file) != 0) {
+		US_LOG_PERROR("REC: Can't flush %s", rec->path);
+		_recorder_resync(rec);
+		goto drop;
+	}
+	const u8 *ptr = (const u8*)run->indexes;
+	uz left = run->n_indexes * sizeof(us_recorder_index_s);
+	while (left > 0) {
+		const ssize_t written = write(run->index_fd, ptr, left);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			US_LOG_PERROR("REC: Can't write the index of %s", rec->path);
+			goto drop;
+		}
+		ptr += written;
+		left -= written;
+	}
+
+drop:
+	// The dropped entries are not lost, the data file can be reindexed by the magics
+	run->n_indexes = 0;
+}
+
+static void _recorder_resync(us_recorder_s *rec) {
+	// A failed write may leave a part of the record in the file, so the offset
+	// is taken from the file itself. Without it the following index entries
+	// would point to the wrong places.
+	us_recorder_runtime_s *const run = rec->run;
+	clearerr(run->data_file);
+	off_t offset;
+	if (fflush(run->data_file) != 0 || (offset = ftello(run->data_file)) < 0) {
+		US_LOG_PERROR("REC: Can't recover the offset of %s, recording is stopped", rec->path);
+		run->n_indexes = 0;
+		US_DELETE(run->data_file, fclose);
+		return;
+	}
+	// The entries of the records which didn't reach the file are dropped
+	while (
+		run->n_indexes > 0
+		&& run->indexes[run->n_indexes - 1].offset + sizeof(us_recorder_header_s)
+			+ run->indexes[run->n_indexes - 1].size > (u64)offset
+	) {
+		--run->n_indexes;
+	}
+	US_LOG_INFO("REC: Recovered the offset of %s: %" PRIu64 " -> %" PRIu64, rec->path, run->offset, (u64)offset);
+	run->offset = offset;
+}
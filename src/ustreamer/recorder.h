@@ -0,0 +1,102 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2023  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#pragma once
+
+#include <stdio.h>
+#include <stdatomic.h>
+
+#include "../libs/types.h"
+#include "../libs/frame.h"
+#include "../libs/tiles.h"
+
+
+// The data file is a sequence of the records: us_recorder_header_s + JPEG.
+// The index file <path>.idx is a sequence of us_recorder_index_s sorted by ts,
+// so the records can be found by the binary search without reading the data.
+// Both files are append-only, all numbers are little-endian on the usual hosts.
+#define US_RECORDER_MAGIC ((u32)0x31524355) // "UCR1"
+
+typedef struct {
+	u32		magic;
+	u32		size;
+	u64		ts; // Wall-clock, microseconds
+	u16		width;
+	u16		height;
+	u32		reserved;
+} us_recorder_header_s;
+
+typedef struct {
+	u64		ts;
+	u64		offset; // Of the header in the data file
+	u32		size;
+	u16		width;
+	u16		height;
+} us_recorder_index_s;
+
+typedef enum {
+	US_RECORDER_IDLE = 0,
+	US_RECORDER_REQUESTED, // By the REC stage, the JPEG stage will put the next frame
+	US_RECORDER_READY, // By the JPEG stage, the REC stage will write the frame
+} us_recorder_state_e;
+
+typedef struct {
+	FILE		*data_file;
+	char		*data_buf;
+	int			index_fd;
+	us_recorder_index_s *indexes; // Pending until the data is flushed
+	uint		n_indexes;
+	u64			offset;
+	u64			last_ts; // Keeps the index sorted if the wall clock goes back
+	ldf			flush_ts;
+
+	// Used by the REC stage only
+	u64			hashes[US_TILES_COUNT];
+	u64			last_hashes[US_TILES_COUNT];
+	bool		has_last;
+	uint		last_width;
+	uint		last_height;
+	uint		last_format;
+	ldf			last_check_ts;
+	ldf			last_request_ts;
+
+	us_frame_s	*jpeg; // Owned by the side which set the state
+	atomic_uint	state;
+	atomic_ullong requested_ts; // Microseconds of the grab_ts
+} us_recorder_runtime_s;
+
+typedef struct {
+	char	*path;
+	uint	interval;
+	uint	threshold;
+
+	us_recorder_runtime_s *run;
+} us_recorder_s;
+
+
+us_recorder_s *us_recorder_init(const char *path, uint interval, uint threshold);
+void us_recorder_destroy(us_recorder_s *rec);
+
+void us_recorder_check(us_recorder_s *rec, const us_frame_s *raw);
+bool us_recorder_is_requested(us_recorder_s *rec);
+void us_recorder_put_jpeg(us_recorder_s *rec, const us_frame_s *jpeg);
@@ -24,6 +24,7 @@
 
 #include <stdlib.h>
 #include <stdatomic.h>
+#include <string.h>
 #include <unistd.h>
 #include <errno.h>
 #include <assert.h>
@@ -31,12 +32,14 @@
 #include <pthread.h>
 
 #include "../libs/types.h"
+#include "../libs/array.h"
 #include "../libs/tools.h"
 #include "../libs/threading.h"
 #include "../libs/process.h"
 #include "../libs/logging.h"
 #include "../libs/ring.h"
 #include "../libs/frame.h"
+#include "../libs/tiles.h"
 #include "../libs/memsink.h"
 #include "../libs/device.h"
 
@@ -58,21 +61,72 @@ typedef struct {
 } _releaser_context_s;
 
 typedef struct {
-	pthread_t	tid;
-	us_queue_s	*queue;
-	us_stream_s	*stream;
-	atomic_bool	*stop;
-} _worker_context_s;
+	bool	valid; // False for (M)JPEG
+	u64		hashes[US_TILES_COUNT];
+} _tiles_s;
+
+typedef struct _stage_context_sx _stage_context_s;
+
+// A consumer of the captured frames, each one runs in its own thread and gets
+// only the latest frame from its queue, the older ones are dropped.
+typedef struct {
+	const char	*name; // For the logs
+	const char	*thread_name;
+	uint		queue_size; // 0 for the number of the HW buffers
+	bool		(*is_enabled)(const us_stream_s *stream);
+	void		(*prepare)(_stage_context_s *ctx); // Optional, called before waiting for a frame
+	bool		(*is_active)(_stage_context_s *ctx); // The frame is dropped if nobody needs it
+	void		(*process)(_stage_context_s *ctx, us_hw_buffer_s *hw); // Must decref the buffer
+} _stage_s;
+
+struct _stage_context_sx {
+	const _stage_s	*stage; // NULL if the stage is disabled
+	pthread_t		tid;
+	us_queue_s		*queue;
+	us_stream_s		*stream;
+	atomic_bool		*stop;
+
+	bool			copying; // See _take_hw_frame()
+	us_frame_s		*copy;
+	us_frame_s		view;
+
+	const _tiles_s	*tiles; // By the index of the HW buffer, NULL without --change-map
+	_tiles_s		last_tiles; // Of the previous frame passed by this stage
+
+	us_worker_s		*ready_wr;
+	ldf				grab_after_ts;
+	ldf				last_process_ts;
+	uint			fluency_passed;
+};
 
 
 static void _stream_set_capture_state(us_stream_s *stream, uint width, uint height, bool online, uint captured_fps);
+static void _stream_set_change_state(us_stream_s *stream, bool mapped, uint changed_tiles, const u8 *map);
 
 static void *_releaser_thread(void *v_ctx);
-static void *_jpeg_thread(void *v_ctx);
-static void *_h264_thread(void *v_ctx);
-static void *_raw_thread(void *v_ctx);
+static void *_stage_thread(void *v_ctx);
+
+static bool _jpeg_is_enabled(const us_stream_s *stream);
+static void _jpeg_prepare(_stage_context_s *ctx);
+static bool _jpeg_is_active(_stage_context_s *ctx);
+static void _jpeg_process(_stage_context_s *ctx, us_hw_buffer_s *hw);
+
+static bool _h264_is_enabled(const us_stream_s *stream);
+static bool _h264_is_active(_stage_context_s *ctx);
+static void _h264_process(_stage_context_s *ctx, us_hw_buffer_s *hw);
+
+static bool _raw_is_enabled(const us_stream_s *stream);
+static bool _raw_is_active(_stage_context_s *ctx);
+static void _raw_process(_stage_context_s *ctx, us_hw_buffer_s *hw);
+
+static bool _rec_is_enabled(const us_stream_s *stream);
+static bool _rec_is_active(_stage_context_s *ctx);
+static void _rec_process(_stage_context_s *ctx, us_hw_buffer_s *hw);
 
 static us_hw_buffer_s *_get_latest_hw(us_queue_s *queue);
+static const us_frame_s *_take_hw_frame(_stage_context_s *ctx, us_hw_buffer_s **hw);
+static void _stage_set_changes(_stage_context_s *ctx, const us_hw_buffer_s *hw, us_frame_s *frame);
+static uint _tiles_get_changes(const _tiles_s *prev, const _tiles_s *tiles, u8 *map);
 
 static bool _stream_has_jpeg_clients_cached(us_stream_s *stream);
 static bool _stream_has_any_clients_cached(us_stream_s *stream);
@@ -82,6 +136,14 @@ static void _stream_expose_raw(us_stream_s *stream, const us_frame_s *frame);
 static void _stream_check_suicide(us_stream_s *stream);
 
 
+static const _stage_s _STAGES[] = {
+	{"JPEG",	"str_jpeg",	0,	_jpeg_is_enabled,	_jpeg_prepare,	_jpeg_is_active,	_jpeg_process},
+	{"H264",	"str_h264",	0,	_h264_is_enabled,	NULL,			_h264_is_active,	_h264_process},
+	{"RAW",		"str_raw",	2,	_raw_is_enabled,	NULL,			_raw_is_active,		_raw_process},
+	{"REC",		"str_rec",	2,	_rec_is_enabled,	NULL,			_rec_is_active,		_rec_process},
+};
+
+
 us_stream_s *us_stream_init(us_device_s *dev, us_encoder_s *enc) {
 	us_stream_runtime_s *run;
 	US_CALLOC(run, 1);
@@ -90,6 +152,11 @@ us_stream_s *us_stream_init(us_device_s *dev, us_encoder_s *enc) {
 	atomic_init(&run->http_snapshot_requested, 0);
 	atomic_init(&run->http_last_request_ts, 0);
 	atomic_init(&run->http_capture_state, 0);
+	atomic_init(&run->change_mapped, false);
+	atomic_init(&run->changed_tiles, 0);
+	for (uint index = 0; index < US_ARRAY_LEN(run->change_map); ++index) {
+		atomic_init(&run->change_map[index], 0);
+	}
 	atomic_init(&run->stop, false);
 	run->blank = us_blank_init();
 
@@ -145,27 +212,31 @@ void us_stream_loop(us_stream_s *stream) {
 			US_THREAD_CREATE(ctx->tid, _releaser_thread, ctx);
 		}
 
-		_worker_context_s jpeg_ctx = {
-			.queue = us_queue_init(dev->run->n_bufs),
-			.stream = stream,
-			.stop = &threads_stop,
-		};
-		US_THREAD_CREATE(jpeg_ctx.tid, _jpeg_thread, &jpeg_ctx);
-
-		_worker_context_s h264_ctx;
-		if (run->h264 != NULL) {
-			h264_ctx.queue = us_queue_init(dev->run->n_bufs);
-			h264_ctx.stream = stream;
-			h264_ctx.stop = &threads_stop;
-			US_THREAD_CREATE(h264_ctx.tid, _h264_thread, &h264_ctx);
+		// The tiles are hashed once by the capturing loop, and each stage compares them
+		// with the previous frame which it passed, so the change map is correct even
+		// if the stage drops some frames.
+		_tiles_s *tiles = NULL;
+		_tiles_s *capture_tiles = NULL;
+		if (stream->change_map) {
+			US_CALLOC(tiles, dev->run->n_bufs);
+			US_CALLOC(capture_tiles, 1);
 		}
 
-		_worker_context_s raw_ctx;
-		if (stream->raw_sink != NULL) {
-			raw_ctx.queue = us_queue_init(2);
-			raw_ctx.stream = stream;
-			raw_ctx.stop = &threads_stop;
-			US_THREAD_CREATE(raw_ctx.tid, _raw_thread, &raw_ctx);
+		_stage_context_s stages[US_ARRAY_LEN(_STAGES)] = {0};
+		for (uint index = 0; index < US_ARRAY_LEN(_STAGES); ++index) {
+			const _stage_s *const stage = &_STAGES[index];
+			if (!stage->is_enabled(stream)) {
+				continue;
+			}
+			_stage_context_s *const ctx = &stages[index];
+			ctx->stage = stage;
+			ctx->queue = us_queue_init(stage->queue_size > 0 ? stage->queue_size : dev->run->n_bufs);
+			ctx->stream = stream;
+			ctx->stop = &threads_stop;
+			ctx->copy = us_frame_init();
+			ctx->tiles = tiles;
+			ctx->last_process_ts = us_get_now_monotonic();
+			US_THREAD_CREATE(ctx->tid, _stage_thread, ctx);
 		}
 
 		uint captured_fps_accum = 0;
@@ -193,19 +264,26 @@ void us_stream_loop(us_stream_s *stream) {
 			captured_fps_accum += 1;
 
 			_stream_set_capture_state(stream, dev->run->width, dev->run->height, true, captured_fps);
+
+			if (tiles != NULL) {
+				// The buffer isn't used by anyone else until it's released, so it's safe to update
+				_tiles_s *const hw_tiles = &tiles[hw->buf.index];
+				hw_tiles->valid = us_tiles_hash(&hw->raw, hw_tiles->hashes);
+				u8 map[US_FRAME_CHANGE_MAP_SIZE] = {0};
+				const uint changed_tiles = (hw_tiles->valid ? _tiles_get_changes(capture_tiles, hw_tiles, map) : 0);
+				_stream_set_change_state(stream, hw_tiles->valid, changed_tiles, map);
+				*capture_tiles = *hw_tiles;
+			}
+
 #			ifdef WITH_GPIO
 			us_gpio_set_stream_online(true);
 #			endif
 
-			us_device_buffer_incref(hw); // JPEG
-			us_queue_put(jpeg_ctx.queue, hw, 0);
-			if (run->h264 != NULL) {
-				us_device_buffer_incref(hw); // H264
-				us_queue_put(h264_ctx.queue, hw, 0);
-			}
-			if (stream->raw_sink != NULL) {
-				us_device_buffer_incref(hw); // RAW
-				us_queue_put(raw_ctx.queue, hw, 0);
+			for (uint index = 0; index < US_ARRAY_LEN(stages); ++index) {
+				if (stages[index].stage != NULL) {
+					us_device_buffer_incref(hw);
+					us_queue_put(stages[index].queue, hw, 0);
+				}
 			}
 			us_queue_put(releasers[hw->buf.index].queue, hw, 0); // Plan to release
 
@@ -223,19 +301,15 @@ void us_stream_loop(us_stream_s *stream) {
 	close:
 		atomic_store(&threads_stop, true);
 
-		if (stream->raw_sink != NULL) {
-			US_THREAD_JOIN(raw_ctx.tid);
-			us_queue_destroy(raw_ctx.queue);
-		}
-
-		if (run->h264 != NULL) {
-			US_THREAD_JOIN(h264_ctx.tid);
-			us_queue_destroy(h264_ctx.queue);
+		for (uint index = US_ARRAY_LEN(stages); index > 0; --index) {
+			_stage_context_s *const ctx = &stages[index - 1];
+			if (ctx->stage != NULL) {
+				US_THREAD_JOIN(ctx->tid);
+				us_queue_destroy(ctx->queue);
+				us_frame_destroy(ctx->copy);
+			}
 		}
 
-		US_THREAD_JOIN(jpeg_ctx.tid);
-		us_queue_destroy(jpeg_ctx.queue);
-
 		for (uint index = 0; index < n_releasers; ++index) {
 			US_THREAD_JOIN(releasers[index].tid);
 			us_queue_destroy(releasers[index].queue);
@@ -243,6 +317,10 @@ void us_stream_loop(us_stream_s *stream) {
 		free(releasers);
 		US_MUTEX_DESTROY(release_mutex);
 
+		US_DELETE(tiles, free);
+		US_DELETE(capture_tiles, free);
+		_stream_set_change_state(stream, false, 0, NULL);
+
 		atomic_store(&threads_stop, false);
 
 		us_encoder_close(stream->enc);
@@ -278,6 +356,30 @@ void _stream_set_capture_state(us_stream_s *stream, uint width, uint height, boo
 	atomic_store(&stream->run->http_capture_state, state);
 }
 
+bool us_stream_get_change_state(us_stream_s *stream, uint *changed_tiles, u8 *map) {
+	// The words of the map may be a bit inconsistent, it's okay for the state
+	const us_stream_runtime_s *const run = stream->run;
+	for (uint index = 0; index < US_ARRAY_LEN(run->change_map); ++index) {
+		const u64 word = atomic_load(&run->change_map[index]);
+		memcpy(map + index * sizeof(word), &word, sizeof(word));
+	}
+	*changed_tiles = atomic_load(&run->changed_tiles);
+	return atomic_load(&run->change_mapped);
+}
+
+static void _stream_set_change_state(us_stream_s *stream, bool mapped, uint changed_tiles, const u8 *map) {
+	us_stream_runtime_s *const run = stream->run;
+	for (uint index = 0; index < US_ARRAY_LEN(run->change_map); ++index) {
+		u64 word = 0;
+		if (map != NULL) {
+			memcpy(&word, map + index * sizeof(word), sizeof(word));
+		}
+		atomic_store(&run->change_map[index], word);
+	}
+	atomic_store(&run->changed_tiles, changed_tiles);
+	atomic_store(&run->change_mapped, mapped);
+}
+
 static void *_releaser_thread(void *v_ctx) {
 	US_THREAD_SETTLE("str_rel")
 	_releaser_context_s *ctx = v_ctx;
@@ -308,33 +410,14 @@ done:
 	return NULL;
 }
 
-static void *_jpeg_thread(void *v_ctx) {
-	US_THREAD_SETTLE("str_jpeg")
-	_worker_context_s *ctx = v_ctx;
-	us_stream_s *stream = ctx->stream;
-
-	ldf grab_after_ts = 0;
-	uint fluency_passed = 0;
+static void *_stage_thread(void *v_ctx) {
+	_stage_context_s *const ctx = v_ctx;
+	const _stage_s *const stage = ctx->stage;
+	US_THREAD_SETTLE("%s", stage->thread_name);
 
 	while (!atomic_load(ctx->stop)) {
-		us_worker_s *const ready_wr = us_workers_pool_wait(stream->enc->run->pool);
-		us_encoder_job_s *const ready_job = ready_wr->job;
-
-		if (ready_job->hw != NULL) {
-			us_device_buffer_decref(ready_job->hw);
-			ready_job->hw = NULL;
-			if (ready_wr->job_failed) {
-				// pass
-			} else if (ready_wr->job_timely) {
-				_stream_expose_jpeg(stream, ready_job->dest);
-				if (atomic_load(&stream->run->http_snapshot_requested) > 0) { // Process real snapshots
-					atomic_fetch_sub(&stream->run->http_snapshot_requested, 1);
-				}
-				US_LOG_PERF("JPEG: ##### Encoded JPEG exposed; worker=%s, latency=%.3Lf",
-					ready_wr->name, us_get_now_monotonic() - ready_job->dest->grab_ts);
-			} else {
-				US_LOG_PERF("JPEG: ----- Encoded JPEG dropped; worker=%s", ready_wr->name);
-			}
+		if (stage->prepare != NULL) {
+			stage->prepare(ctx);
 		}
 
 		us_hw_buffer_s *hw = _get_latest_hw(ctx->queue);
@@ -342,98 +425,149 @@ static void *_jpeg_thread(void *v_ctx) {
 			continue;
 		}
 
-		const bool update_required = (stream->jpeg_sink != NULL && us_memsink_server_check(stream->jpeg_sink, NULL));
-		if (!update_required && !_stream_has_jpeg_clients_cached(stream)) {
-			US_LOG_VERBOSE("JPEG: Passed encoding because nobody is watching");
-			us_device_buffer_decref(hw);
-			continue;
-		}
-
-		const ldf now_ts = us_get_now_monotonic();
-		if (now_ts < grab_after_ts) {
-			fluency_passed += 1;
-			US_LOG_VERBOSE("JPEG: Passed %u frames for fluency: now=%.03Lf, grab_after=%.03Lf",
-				fluency_passed, now_ts, grab_after_ts);
+		if (!stage->is_active(ctx)) {
+			US_LOG_VERBOSE("%s: Passed the frame because nobody is watching", stage->name);
 			us_device_buffer_decref(hw);
 			continue;
 		}
-		fluency_passed = 0;
-
-		const ldf fluency_delay = us_workers_pool_get_fluency_delay(stream->enc->run->pool, ready_wr);
-		grab_after_ts = now_ts + fluency_delay;
-		US_LOG_VERBOSE("JPEG: Fluency: delay=%.03Lf, grab_after=%.03Lf", fluency_delay, grab_after_ts);
 
-		ready_job->hw = hw;
-		us_workers_pool_assign(stream->enc->run->pool, ready_wr);
-		US_LOG_DEBUG("JPEG: Assigned new frame in buffer=%d to worker=%s", hw->buf.index, ready_wr->name);
+		stage->process(ctx, hw);
 	}
 	return NULL;
 }
 
-static void *_h264_thread(void *v_ctx) {
-	US_THREAD_SETTLE("str_h264");
-	_worker_context_s *ctx = v_ctx;
-	us_h264_stream_s *h264 = ctx->stream->run->h264;
+static bool _jpeg_is_enabled(const us_stream_s *stream) {
+	(void)stream;
+	return true; // For HTTP
+}
 
-	ldf grab_after_ts = 0;
-	ldf last_encode_ts = us_get_now_monotonic();
+static void _jpeg_prepare(_stage_context_s *ctx) {
+	us_stream_s *const stream = ctx->stream;
 
-	while (!atomic_load(ctx->stop)) {
-		us_hw_buffer_s *hw = _get_latest_hw(ctx->queue);
-		if (hw == NULL) {
-			continue;
-		}
+	us_worker_s *const ready_wr = us_workers_pool_wait(stream->enc->run->pool);
+	us_encoder_job_s *const ready_job = ready_wr->job;
 
-		if (!us_memsink_server_check(h264->sink, NULL)) {
-			us_device_buffer_decref(hw);
-			US_LOG_VERBOSE("H264: Passed encoding because nobody is watching");
-			continue;
+	if (ready_job->hw != NULL) {
+		if (!ready_wr->job_failed && ready_wr->job_timely) {
+			_stage_set_changes(ctx, ready_job->hw, ready_job->dest);
 		}
-
-		if (hw->raw.grab_ts < grab_after_ts) {
-			us_device_buffer_decref(hw);
-			US_LOG_VERBOSE("H264: Passed encoding for FPS limit: %u", h264->enc->run->fps_limit);
-			continue;
+		us_device_buffer_decref(ready_job->hw);
+		ready_job->hw = NULL;
+		if (ready_wr->job_failed) {
+			// pass
+		} else if (ready_wr->job_timely) {
+			_stream_expose_jpeg(stream, ready_job->dest);
+			if (stream->recorder != NULL) {
+				us_recorder_put_jpeg(stream->recorder, ready_job->dest);
+			}
+			if (atomic_load(&stream->run->http_snapshot_requested) > 0) { // Process real snapshots
+				atomic_fetch_sub(&stream->run->http_snapshot_requested, 1);
+			}
+			US_LOG_PERF("JPEG: ##### Encoded JPEG exposed; worker=%s, latency=%.3Lf",
+				ready_wr->name, us_get_now_monotonic() - ready_job->dest->grab_ts);
+		} else {
+			US_LOG_PERF("JPEG: ----- Encoded JPEG dropped; worker=%s", ready_wr->name);
 		}
+	}
+	ctx->ready_wr = ready_wr;
+}
 
-		// Форсим кейфрейм, если от захвата давно не было фреймов
-		const ldf now_ts = us_get_now_monotonic();
-		const bool force_key = (last_encode_ts + 0.5 < now_ts);
-		us_h264_stream_process(h264, &hw->raw, force_key);
-		last_encode_ts = now_ts;
+static bool _jpeg_is_active(_stage_context_s *ctx) {
+	us_stream_s *const stream = ctx->stream;
+	const bool update_required = (stream->jpeg_sink != NULL && us_memsink_server_check(stream->jpeg_sink, NULL));
+	const bool record_required = (stream->recorder != NULL && us_recorder_is_requested(stream->recorder));
+	return (update_required || record_required || _stream_has_jpeg_clients_cached(stream));
+}
 
-		// M2M-енкодер увеличивает задержку на 100 милисекунд при 1080p, если скормить ему больше 30 FPS.
-		// Поэтому у нас есть два режима: 60 FPS для маленьких видео и 30 для 1920x1080(1200).
-		// Следующй фрейм захватывается не раньше, чем это требуется по FPS, минус небольшая
-		// погрешность (если захват неравномерный) - немного меньше 1/60, и примерно треть от 1/30.
-		const ldf frame_interval = (ldf)1 / h264->enc->run->fps_limit;
-		grab_after_ts = hw->raw.grab_ts + frame_interval - 0.01;
+static void _jpeg_process(_stage_context_s *ctx, us_hw_buffer_s *hw) {
+	us_stream_s *const stream = ctx->stream;
+	us_worker_s *const ready_wr = ctx->ready_wr;
 
+	const ldf now_ts = us_get_now_monotonic();
+	if (now_ts < ctx->grab_after_ts) {
+		ctx->fluency_passed += 1;
+		US_LOG_VERBOSE("JPEG: Passed %u frames for fluency: now=%.03Lf, grab_after=%.03Lf",
+			ctx->fluency_passed, now_ts, ctx->grab_after_ts);
 		us_device_buffer_decref(hw);
+		return;
 	}
-	return NULL;
+	ctx->fluency_passed = 0;
+
+	const ldf fluency_delay = us_workers_pool_get_fluency_delay(stream->enc->run->pool, ready_wr);
+	ctx->grab_after_ts = now_ts + fluency_delay;
+	US_LOG_VERBOSE("JPEG: Fluency: delay=%.03Lf, grab_after=%.03Lf", fluency_delay, ctx->grab_after_ts);
+
+	us_encoder_job_s *const ready_job = ready_wr->job;
+	ready_job->hw = hw;
+	us_workers_pool_assign(stream->enc->run->pool, ready_wr);
+	US_LOG_DEBUG("JPEG: Assigned new frame in buffer=%d to worker=%s", hw->buf.index, ready_wr->name);
 }
 
-static void *_raw_thread(void *v_ctx) {
-	US_THREAD_SETTLE("str_raw");
-	_worker_context_s *ctx = v_ctx;
+static bool _h264_is_enabled(const us_stream_s *stream) {
+	return (stream->run->h264 != NULL);
+}
 
-	while (!atomic_load(ctx->stop)) {
-		us_hw_buffer_s *hw = _get_latest_hw(ctx->queue);
-		if (hw == NULL) {
-			continue;
-		}
+static bool _h264_is_active(_stage_context_s *ctx) {
+	return us_memsink_server_check(ctx->stream->run->h264->sink, NULL);
+}
 
-		if (!us_memsink_server_check(ctx->stream->raw_sink, NULL)) {
-			us_device_buffer_decref(hw);
-			US_LOG_VERBOSE("RAW: Passed publishing because nobody is watching");
-			continue;
-		}
+static void _h264_process(_stage_context_s *ctx, us_hw_buffer_s *hw) {
+	us_h264_stream_s *const h264 = ctx->stream->run->h264;
 
-		us_memsink_server_put(ctx->stream->raw_sink, &hw->raw, false);
+	if (hw->raw.grab_ts < ctx->grab_after_ts) {
+		us_device_buffer_decref(hw);
+		US_LOG_VERBOSE("H264: Passed encoding for FPS limit: %u", h264->enc->run->fps_limit);
+		return;
+	}
+
+	// Форсим кейфрейм, если от захвата давно не было фреймов
+	const ldf now_ts = us_get_now_monotonic();
+	const bool force_key = (ctx->last_process_ts + 0.5 < now_ts);
+	const us_frame_s *const frame = _take_hw_frame(ctx, &hw);
+	us_h264_stream_process(h264, frame, force_key);
+	ctx->last_process_ts = now_ts;
+
+	// M2M-енкодер увеличивает задержку на 100 милисекунд при 1080p, если скормить ему больше 30 FPS.
+	// Поэтому у нас есть два режима: 60 FPS для маленьких видео и 30 для 1920x1080(1200).
+	// Следующй фрейм захватывается не раньше, чем это требуется по FPS, минус небольшая
+	// погрешность (если захват неравномерный) - немного меньше 1/60, и примерно треть от 1/30.
+	const ldf frame_interval = (ldf)1 / h264->enc->run->fps_limit;
+	ctx->grab_after_ts = frame->grab_ts + frame_interval - 0.01;
+
+	if (hw != NULL) {
+		us_device_buffer_decref(hw);
+	}
+}
+
+static bool _raw_is_enabled(const us_stream_s *stream) {
+	return (stream->raw_sink != NULL);
+}
+
+static bool _raw_is_active(_stage_context_s *ctx) {
+	return us_memsink_server_check(ctx->stream->raw_sink, NULL);
+}
+
+static void _raw_process(_stage_context_s *ctx, us_hw_buffer_s *hw) {
+	const us_frame_s *const frame = _take_hw_frame(ctx, &hw);
+	us_memsink_server_put(ctx->stream->raw_sink, frame, false);
+	if (hw != NULL) {
 		us_device_buffer_decref(hw);
 	}
-	return NULL;
+}
+
+static bool _rec_is_enabled(const us_stream_s *stream) {
+	return (stream->recorder != NULL);
+}
+
+static bool _rec_is_active(_stage_context_s *ctx) {
+	(void)ctx;
+	return true;
+}
+
+static void _rec_process(_stage_context_s *ctx, us_hw_buffer_s *hw) {
+	// Only hashes the raw frame, the JPEG is encoded by the JPEG stage on request
+	us_recorder_check(ctx->stream->recorder, &hw->raw);
+	us_device_buffer_decref(hw);
 }
 
 static us_hw_buffer_s *_get_latest_hw(us_queue_s *queue) {
@@ -448,6 +582,58 @@ static us_hw_buffer_s *_get_latest_hw(us_queue_s *queue) {
 	return hw;
 }
 
+static const us_frame_s *_take_hw_frame(_stage_context_s *ctx, us_hw_buffer_s **hw) {
+	// When the driver is running out of the buffers, a slow consumer copies the frame
+	// and gives the HW buffer back immediately, so it doesn't starve the capturing.
+	// The copying is sticky till the reopening to not reconfigure the M2M encoder
+	// between DMA and non-DMA inputs back and forth.
+	const us_stream_s *const stream = ctx->stream;
+	if (!ctx->copying && stream->copy_on_pressure > 0) {
+		const uint queued = atomic_load(&stream->dev->run->bufs_stat.queued);
+		if (queued < stream->copy_on_pressure) {
+			US_LOG_INFO("%s: Only %u buffers are left in the driver, switching to copying of the frames",
+				ctx->stage->name, queued);
+			ctx->copying = true;
+		}
+	}
+	if (!ctx->copying) {
+		if (ctx->tiles == NULL) {
+			return &(*hw)->raw;
+		}
+		// A shallow copy carries the changes for this stage without touching the shared buffer
+		ctx->view = (*hw)->raw;
+		_stage_set_changes(ctx, *hw, &ctx->view);
+		return &ctx->view;
+	}
+	us_frame_copy(&(*hw)->raw, ctx->copy);
+	_stage_set_changes(ctx, *hw, ctx->copy);
+	us_device_buffer_decref(*hw);
+	*hw = NULL;
+	return ctx->copy;
+}
+
+static void _stage_set_changes(_stage_context_s *ctx, const us_hw_buffer_s *hw, us_frame_s *frame) {
+	// Must be called before the buffer is released, otherwise it can be regrabbed with other tiles
+	if (ctx->tiles == NULL) {
+		return;
+	}
+	const _tiles_s *const tiles = &ctx->tiles[hw->buf.index];
+	frame->change_mapped = tiles->valid;
+	if (tiles->valid) {
+		frame->changed_tiles = _tiles_get_changes(&ctx->last_tiles, tiles, frame->change_map);
+	}
+	ctx->last_tiles = *tiles;
+}
+
+static uint _tiles_get_changes(const _tiles_s *prev, const _tiles_s *tiles, u8 *map) {
+	// Everything is changed if there is nothing to compare with
+	if (!prev->valid) {
+		memset(map, 0xFF, US_FRAME_CHANGE_MAP_SIZE);
+		return US_TILES_COUNT;
+	}
+	return us_tiles_compare(prev->hashes, tiles->hashes, map);
+}
+
 static bool _stream_has_jpeg_clients_cached(us_stream_s *stream) {
 	const us_stream_runtime_s *const run = stream->run;
 	return (
@@ -528,7 +714,7 @@ static int _stream_init_loop(us_stream_s *stream) {
 
 				_stream_expose_jpeg(stream, run->blank->jpeg);
 				if (run->h264 != NULL) {
-					us_h264_stream_process(run->h264, run->blank->raw, true);
+					us_h264_stream_process_blank(run->h264, run->blank);
 				}
 				_stream_expose_raw(stream, run->blank->raw);
 			}
@@ -549,6 +735,10 @@ static void _stream_expose_jpeg(us_stream_s *stream, const us_frame_s *frame) {
 	us_frame_s *const dest = run->http_jpeg_ring->items[ri];
 	us_frame_copy(frame, dest);
 	us_ring_producer_release(run->http_jpeg_ring, ri);
+	if (stream->history != NULL) {
+		// The blank has no grab_ts
+		us_history_put(stream->history, frame, (frame->online ? frame->grab_ts : us_get_now_monotonic()));
+	}
 	if (stream->jpeg_sink != NULL) {
 		us_memsink_server_put(stream->jpeg_sink, dest, NULL);
 	}
@@ -27,6 +27,7 @@
 #include <pthread.h>
 
 #include "../libs/types.h"
+#include "../libs/frame.h"
 #include "../libs/queue.h"
 #include "../libs/ring.h"
 #include "../libs/memsink.h"
@@ -35,6 +36,8 @@
 #include "blank.h"
 #include "encoder.h"
 #include "h264.h"
+#include "history.h"
+#include "recorder.h"
 
 
 typedef struct {
@@ -46,6 +49,10 @@ typedef struct {
 	atomic_ullong	http_last_request_ts; // Seconds
 	atomic_ullong	http_capture_state; // Bits
 
+	atomic_bool		change_mapped;
+	atomic_uint		changed_tiles;
+	atomic_ullong	change_map[US_FRAME_CHANGE_MAP_SIZE / 8]; // Of the latest captured frame
+
 	us_blank_s		*blank;
 
 	atomic_bool		stop;
@@ -59,6 +66,8 @@ typedef struct {
 	bool			slowdown;
 	uint			error_delay;
 	uint			exit_on_no_clients;
+	uint			copy_on_pressure;
+	bool			change_map;
 
 	us_memsink_s	*jpeg_sink;
 	us_memsink_s	*raw_sink;
@@ -68,6 +77,9 @@ typedef struct {
 	uint			h264_gop;
 	char			*h264_m2m_path;
 
+	us_history_s	*history;
+	us_recorder_s	*recorder;
+
 	us_stream_runtime_s	*run;
 } us_stream_s;
 
@@ -79,3 +91,4 @@ void us_stream_loop(us_stream_s *stream);
 void us_stream_loop_break(us_stream_s *stream);
 
 void us_stream_get_capture_state(us_stream_s *stream, uint *width, uint *height, bool *online, uint *captured_fps);
+bool us_stream_get_change_state(us_stream_s *stream, uint *changed_tiles, u8 *map);
@@ -0,0 +1,236 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2023  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#include "conv.h"
+
+#include <string.h>
+#include <assert.h>
+
+#include <linux/videodev2.h>
+
+#include "../libs/types.h"
+#include "../libs/tools.h"
+#include "../libs/frame.h"
+#include "../libs/unjpeg.h"
+
+
+static void _conv_yuv(const us_frame_s *src, u8 *dest, uint width, uint height, uint stride);
+static void _conv_planar(const us_frame_s *src, u8 *dest, uint width, uint height, uint stride);
+static void _conv_grey(const us_frame_s *src, u8 *dest, uint width, uint height, uint stride);
+static void _conv_rgb565(const us_frame_s *src, u8 *dest, uint width, uint height, uint stride);
+static void _conv_rgb24(const us_frame_s *src, u8 *dest, uint width, uint height, uint stride);
+static void _conv_bgr24(const us_frame_s *src, u8 *dest, uint width, uint height, uint stride);
+
+static inline void _put_yuv_pixel(u8 *ptr, int y, int dr, int dg, int db);
+static inline u8 _clamp(int value);
+
+
+us_conv_s *us_conv_init(void) {
+	us_conv_s *conv;
+	US_CALLOC(conv, 1);
+	conv->decoded = us_frame_init();
+	return conv;
+}
+
+void us_conv_destroy(us_conv_s *conv) {
+	us_frame_destroy(conv->decoded);
+	free(conv);
+}
+
+bool us_conv_is_supported(uint format) {
+	switch (format) {
+		case V4L2_PIX_FMT_YUYV:
+		case V4L2_PIX_FMT_YVYU:
+		case V4L2_PIX_FMT_UYVY:
+		case V4L2_PIX_FMT_NV12:
+		case V4L2_PIX_FMT_NV16:
+		case V4L2_PIX_FMT_YUV420:
+		case V4L2_PIX_FMT_GREY:
+		case V4L2_PIX_FMT_RGB565:
+		case V4L2_PIX_FMT_RGB24:
+		case V4L2_PIX_FMT_BGR24:
+		case V4L2_PIX_FMT_MJPEG:
+		case V4L2_PIX_FMT_JPEG:
+			return true;
+	}
+	return false;
+}
+
+int us_conv_to_rgb24(us_conv_s *conv, const us_frame_s *src, u8 *dest, uint width, uint height, uint stride) {
+	// The destination is RGB24 with the specified stride.
+	// The source is cropped by the destination, the rest is not touched.
+
+	if (us_is_jpeg(src->format)) {
+		if (us_unjpeg(src, conv->decoded, true) < 0) {
+			return -1;
+		}
+		src = conv->decoded;
+	}
+
+	width = US_MIN(width, src->width);
+	height = US_MIN(height, src->height);
+
+	switch (src->format) {
+		case V4L2_PIX_FMT_YUYV:
+		case V4L2_PIX_FMT_YVYU:
+		case V4L2_PIX_FMT_UYVY:		_conv_yuv(src, dest, width, height, stride); break;
+		case V4L2_PIX_FMT_NV12:
+		case V4L2_PIX_FMT_NV16:
+		case V4L2_PIX_FMT_YUV420:	_conv_planar(src, dest, width, height, stride); break;
+		case V4L2_PIX_FMT_GREY:		_conv_grey(src, dest, width, height, stride); break;
+		case V4L2_PIX_FMT_RGB565:	_conv_rgb565(src, dest, width, height, stride); break;
+		case V4L2_PIX_FMT_RGB24:	_conv_rgb24(src, dest, width, height, stride); break;
+		case V4L2_PIX_FMT_BGR24:	_conv_bgr24(src, dest, width, height, stride); break;
+		default: assert(0 && "Unsupported pixel format");
+	}
+	return 0;
+}
+
+static void _conv_yuv(const us_frame_s *src, u8 *dest, uint width, uint height, uint stride) {
+	// See also: https://www.kernel.org/doc/html/v4.8/media/uapi/v4l/pixfmt-uyvy.html
+	// Offsets of Y0, U, Y1, V in the macropixel
+	uint oy0, ou, oy1, ov;
+	switch (src->format) {
+		case V4L2_PIX_FMT_YUYV: oy0 = 0; ou = 1; oy1 = 2; ov = 3; break;
+		case V4L2_PIX_FMT_YVYU: oy0 = 0; ov = 1; oy1 = 2; ou = 3; break;
+		case V4L2_PIX_FMT_UYVY: ou = 0; oy0 = 1; ov = 2; oy1 = 3; break;
+		default: assert(0 && "Unsupported pixel format"); return; // Makes linter happy
+	}
+
+	for (uint y = 0; y < height; ++y) {
+		const u8 *data = src->data + y * src->stride;
+		u8 *ptr = dest + y * stride;
+
+		// Fixed point BT.601 with the limited range, without branches in the inner loop,
+		// so the compiler can vectorize it.
+		for (uint x = 0; x + 1 < width; x += 2) {
+			const int u = data[ou] - 128;
+			const int v = data[ov] - 128;
+			const int dr = 409 * v + 128;
+			const int dg = -100 * u - 208 * v + 128;
+			const int db = 516 * u + 128;
+
+			_put_yuv_pixel(ptr, data[oy0], dr, dg, db);
+			_put_yuv_pixel(ptr + 3, data[oy1], dr, dg, db);
+			ptr += 6;
+
+			data += 4;
+		}
+	}
+}
+
+static void _conv_planar(const us_frame_s *src, u8 *dest, uint width, uint height, uint stride) {
+	// NV12 and NV16 have the interleaved CbCr plane with the same stride as the Y plane,
+	// YUV420 has the separate Cb and Cr planes with the half of the stride and the height,
+	// rounded up for the odd sizes.
+	const u8 *const chroma = src->data + src->stride * src->height;
+	const bool nv = (src->format != V4L2_PIX_FMT_YUV420);
+	const uint chroma_stride = (nv ? src->stride : (src->stride + 1) / 2);
+	const uint shift = (src->format == V4L2_PIX_FMT_NV16 ? 0 : 1); // Vertical subsampling
+	const u8 *const cr_plane = chroma + chroma_stride * ((src->height + 1) / 2);
+
+	for (uint y = 0; y < height; ++y) {
+		const u8 *luma = src->data + y * src->stride;
+		const u8 *cb = chroma + (y >> shift) * chroma_stride;
+		const u8 *cr = (nv ? cb + 1 : cr_plane + (y >> shift) * chroma_stride);
+		const uint chroma_step = (nv ? 2 : 1);
+		u8 *ptr = dest + y * stride;
+
+		for (uint x = 0; x + 1 < width; x += 2) {
+			const int u = *cb - 128;
+			const int v = *cr - 128;
+			const int dr = 409 * v + 128;
+			const int dg = -100 * u - 208 * v + 128;
+			const int db = 516 * u + 128;
+
+			_put_yuv_pixel(ptr, luma[0], dr, dg, db);
+			_put_yuv_pixel(ptr + 3, luma[1], dr, dg, db);
+			ptr += 6;
+
+			luma += 2;
+			cb += chroma_step;
+			cr += chroma_step;
+		}
+	}
+}
+
+static void _conv_grey(const us_frame_s *src, u8 *dest, uint width, uint height, uint stride) {
+	for (uint y = 0; y < height; ++y) {
+		const u8 *data = src->data + y * src->stride;
+		u8 *ptr = dest + y * stride;
+
+		for (uint x = 0; x < width; ++x) {
+			ptr[0] = ptr[1] = ptr[2] = *data;
+			ptr += 3;
+			++data;
+		}
+	}
+}
+
+static void _conv_rgb565(const us_frame_s *src, u8 *dest, uint width, uint height, uint stride) {
+	for (uint y = 0; y < height; ++y) {
+		const u8 *data = src->data + y * src->stride;
+		u8 *ptr = dest + y * stride;
+
+		for (uint x = 0; x < width; ++x) {
+			const uint two_byte = (data[1] << 8) + data[0];
+			ptr[0] = data[1] & 248; // Red
+			ptr[1] = (u8)((two_byte & 2016) >> 3); // Green
+			ptr[2] = (data[0] & 31) * 8; // Blue
+			ptr += 3;
+			data += 2;
+		}
+	}
+}
+
+static void _conv_rgb24(const us_frame_s *src, u8 *dest, uint width, uint height, uint stride) {
+	for (uint y = 0; y < height; ++y) {
+		memcpy(dest + y * stride, src->data + y * src->stride, width * 3);
+	}
+}
+
+static void _conv_bgr24(const us_frame_s *src, u8 *dest, uint width, uint height, uint stride) {
+	for (uint y = 0; y < height; ++y) {
+		const u8 *data = src->data + y * src->stride;
+		u8 *ptr = dest + y * stride;
+
+		for (uint x = 0; x < width; ++x) {
+			ptr[0] = data[2]; // Red
+			ptr[1] = data[1]; // Green
+			ptr[2] = data[0]; // Blue
+			ptr += 3;
+			data += 3;
+		}
+	}
+}
+
+static inline void _put_yuv_pixel(u8 *ptr, int y, int dr, int dg, int db) {
+	// Fixed point BT.601 with the limited range, dr/dg/db are the chroma parts
+	const int c = 298 * (y - 16);
+	ptr[0] = _clamp((c + dr) >> 8);
+	ptr[1] = _clamp((c + dg) >> 8);
+	ptr[2] = _clamp((c + db) >> 8);
+}
+
+static inline u8 _clamp(int value) {
+	return (value < 0 ? 0 : (value > 255 ? 255 : value));
+}
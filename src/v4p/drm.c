@@ -23,8 +23,10 @@
 #include "drm.h"
 
 #include <string.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
 
 #include <sys/mman.h>
 #include <sys/stat.h>
@@ -43,16 +45,26 @@
 #include "../libs/frame.h"
 #include "../libs/frametext.h"
 
+#include "conv.h"
 
+
+static int _drm_open(us_drm_s *drm, const us_device_s *dev, const us_frame_s *frame);
 static void _drm_vsync_callback(int fd, uint n_frame, uint sec, uint usec, void *v_buf);
 static int _drm_check_status(us_drm_s *drm);
 static void _drm_ensure_dpms_power(us_drm_s *drm, bool on);
 static int _drm_init_buffers(us_drm_s *drm, const us_device_s *dev);
 static int _drm_find_sink(us_drm_s *drm, uint width, uint height, float hz);
+static int _drm_flip(us_drm_s *drm, us_drm_buffer_s *buf);
+
+static int _drm_atomic_init(us_drm_s *drm);
+static int _drm_atomic_modeset(us_drm_s *drm);
+static int _drm_atomic_commit(us_drm_s *drm, us_drm_buffer_s *buf, u32 flags);
 
 static drmModeModeInfo *_find_best_mode(drmModeConnector *conn, uint width, uint height, float hz);
 static u32 _find_dpms(int fd, drmModeConnector *conn);
 static u32 _find_crtc(int fd, drmModeRes *res, drmModeConnector *conn, u32 *taken_crtcs);
+static u32 _find_primary_plane(int fd, u32 crtc_id);
+static u32 _find_property(int fd, u32 obj_id, u32 obj_type, const char *name, u64 *value);
 static const char *_connector_type_to_string(u32 type);
 static float _get_refresh_rate(const drmModeModeInfo *mode);
 
@@ -72,6 +84,7 @@ us_drm_s *us_drm_init(void) {
 	run->dpms_state = -1;
 	run->has_vsync = true;
 	run->exposing_dma_fd = -1;
+	run->out_fence = -1;
 	run->ft = us_frametext_init();
 
 	us_drm_s *drm;
@@ -80,6 +93,7 @@ us_drm_s *us_drm_init(void) {
 	drm->path = "/dev/dri/by-path/platform-gpu-card";
 	drm->port = "HDMI-A-1";
 	drm->timeout = 5;
+	drm->atomic = true;
 	drm->run = run;
 	return drm;
 }
@@ -91,9 +105,21 @@ void us_drm_destroy(us_drm_s *drm) {
 }
 
 int us_drm_open(us_drm_s *drm, const us_device_s *dev) {
+	return _drm_open(drm, dev, NULL);
+}
+
+int us_drm_open_frame(us_drm_s *drm, const us_frame_s *frame) {
+	assert(frame != NULL);
+	return _drm_open(drm, NULL, frame);
+}
+
+static int _drm_open(us_drm_s *drm, const us_device_s *dev, const us_frame_s *frame) {
+	// The source is the capture device with DMA, or the frame for the CPU conversion,
+	// or nothing for the user stub.
 	us_drm_runtime_s *const run = drm->run;
 
 	assert(run->fd < 0);
+	assert(dev == NULL || frame == NULL);
 
 	switch (_drm_check_status(drm)) {
 		case 0: break;
@@ -101,7 +127,7 @@ int us_drm_open(us_drm_s *drm, const us_device_s *dev) {
 		default: goto error;
 	}
 
-	_D_LOG_INFO("Configuring DRM device for %s ...", (dev == NULL ? "STUB" : "DMA"));
+	_D_LOG_INFO("Configuring DRM device for %s ...", (dev != NULL ? "DMA" : (frame != NULL ? "CONV" : "STUB")));
 
 	if ((run->fd = open(drm->path, O_RDWR | O_CLOEXEC | O_NONBLOCK)) < 0) {
 		_D_LOG_PERROR("Can't open DRM device");
@@ -109,14 +135,27 @@ int us_drm_open(us_drm_s *drm, const us_device_s *dev) {
 	}
 	_D_LOG_DEBUG("DRM device fd=%d opened", run->fd);
 
+	run->src_width = (dev != NULL ? dev->run->width : (frame != NULL ? frame->width : 0));
+	run->src_height = (dev != NULL ? dev->run->height : (frame != NULL ? frame->height : 0));
+	run->src_format = (dev != NULL ? dev->run->format : (frame != NULL ? frame->format : 0));
+	run->src_hz = (dev != NULL ? dev->run->hz : 0);
+	const bool src_dma = (dev != NULL && dev->run->dma);
+
 	int stub = 0; // Open the real device with DMA
-	if (dev == NULL) {
+	bool conv = false; // Or with dumb buffers for the CPU conversion
+	if (dev == NULL && frame == NULL) {
 		stub = US_DRM_STUB_USER;
-	} else if (dev->run->format != V4L2_PIX_FMT_RGB24) {
-		stub = US_DRM_STUB_BAD_FORMAT;
+	} else if (run->src_format != V4L2_PIX_FMT_RGB24 || !src_dma) {
 		char fourcc_str[8];
-		us_fourcc_to_string(dev->run->format, fourcc_str, 8);
-		_D_LOG_ERROR("Input format %s is not supported, forcing to STUB ...", fourcc_str);
+		us_fourcc_to_string(run->src_format, fourcc_str, 8);
+		if (us_conv_is_supported(run->src_format)) {
+			conv = true;
+			_D_LOG_INFO("Input format %s%s can't be scanned out directly, using CPU conversion ...",
+				fourcc_str, (src_dma ? "" : " without DMA"));
+		} else {
+			stub = US_DRM_STUB_BAD_FORMAT;
+			_D_LOG_ERROR("Input format %s is not supported, forcing to STUB ...", fourcc_str);
+		}
 	}
 
 #	define CHECK_CAP(x_cap) { \
@@ -132,40 +171,74 @@ int us_drm_open(us_drm_s *drm, const us_device_s *dev) {
 			} \
 		}
 	CHECK_CAP(DRM_CAP_DUMB_BUFFER);
-	if (stub == 0) {
+	if (stub == 0 && !conv) {
 		CHECK_CAP(DRM_CAP_PRIME);
 	}
 #	undef CHECK_CAP
 
-	const uint width = (stub > 0 ? 0 : dev->run->width);
-	const uint height = (stub > 0 ? 0 : dev->run->height);
-	const uint hz = (stub > 0 ? 0 : dev->run->hz);
+	const uint width = (stub > 0 ? 0 : run->src_width);
+	const uint height = (stub > 0 ? 0 : run->src_height);
+	const uint hz = (stub > 0 ? 0 : run->src_hz);
 	switch (_drm_find_sink(drm, width, height, hz)) {
 		case 0: break;
 		case -2: goto unplugged;
 		default: goto error;
 	}
+
+	run->atomic = false;
+	if (drm->atomic && !run->atomic_disabled) {
+		if (_drm_atomic_init(drm) == 0) {
+			run->atomic = true;
+		} else {
+			_D_LOG_INFO("Atomic KMS is not available, using legacy API");
+			run->atomic_disabled = true;
+		}
+	}
+
 	if ((stub == 0) && (width != run->mode.hdisplay || height < run->mode.vdisplay)) {
-		// We'll try to show something instead of nothing if height != vdisplay
-		stub = US_DRM_STUB_BAD_RESOLUTION;
-		_D_LOG_ERROR("There is no appropriate modes for the capture, forcing to STUB ...");
+		if (run->atomic) {
+			_D_LOG_INFO("There is no exact mode for the capture, using plane scaling ...");
+		} else {
+			// We'll try to show something instead of nothing if height != vdisplay
+			stub = US_DRM_STUB_BAD_RESOLUTION;
+			_D_LOG_ERROR("There is no appropriate modes for the capture, forcing to STUB ...");
+		}
 	}
 
-	if (_drm_init_buffers(drm, (stub > 0 ? NULL : dev)) < 0) {
+	// Legacy API crops the capture by the mode, atomic one scales it
+	run->fb_width = ((stub == 0 && run->atomic) ? width : run->mode.hdisplay);
+	run->fb_height = ((stub == 0 && run->atomic) ? height : run->mode.vdisplay);
+
+	run->opened_for_conv = (stub == 0 && conv);
+	if (_drm_init_buffers(drm, (stub > 0 || conv ? NULL : dev)) < 0) {
 		goto error;
 	}
 
 	run->saved_crtc = drmModeGetCrtc(run->fd, run->crtc_id);
-	_D_LOG_DEBUG("Setting up CRTC ...");
-	if (drmModeSetCrtc(run->fd, run->crtc_id, run->bufs[0].id, 0, 0, &run->conn_id, 1, &run->mode) < 0) {
-		_D_LOG_PERROR("Can't set CRTC");
-		goto error;
+	if (run->atomic) {
+		const int modeset = _drm_atomic_modeset(drm);
+		if (modeset < 0) {
+			if (modeset == -2) {
+				// The driver can't show our plane at all, the next opening will use the legacy API.
+				// The other errors may be transient (like unplugging), so atomic is kept for them.
+				run->atomic_disabled = true;
+			}
+			goto error;
+		}
+	} else {
+		_D_LOG_DEBUG("Setting up CRTC ...");
+		if (drmModeSetCrtc(run->fd, run->crtc_id, run->bufs[0].id, 0, 0, &run->conn_id, 1, &run->mode) < 0) {
+			_D_LOG_PERROR("Can't set CRTC");
+			goto error;
+		}
 	}
 
 	run->opened_for_stub = (stub > 0);
 	run->exposing_dma_fd = -1;
 	run->unplugged_reported = false;
-	_D_LOG_INFO("Opened for %s ...", (run->opened_for_stub ? "STUB" : "DMA"));
+	_D_LOG_INFO("Opened for %s using %s API ...",
+		(run->opened_for_stub ? "STUB" : (run->opened_for_conv ? "CONV" : "DMA")),
+		(run->atomic ? "atomic" : "legacy"));
 	return stub;
 
 error:
@@ -226,11 +299,21 @@ void us_drm_close(us_drm_s *drm) {
 		run->n_bufs = 0;
 	}
 
+	if (run->mode_blob_id > 0) {
+		if (drmModeDestroyPropertyBlob(run->fd, run->mode_blob_id) < 0) {
+			_D_LOG_PERROR("Can't destroy mode blob");
+		}
+		run->mode_blob_id = 0;
+	}
+	US_CLOSE_FD(run->out_fence);
+
 	const bool say = (run->fd >= 0);
 	US_CLOSE_FD(run->status_fd);
 	US_CLOSE_FD(run->fd);
 
 	run->crtc_id = 0;
+	run->plane_id = 0;
+	run->atomic = false;
 	run->dpms_state = -1;
 	run->has_vsync = true;
 	run->stub_n_buf = 0;
@@ -270,6 +353,25 @@ int us_drm_wait_for_vsync(us_drm_s *drm) {
 		return 0;
 	}
 
+	if (run->out_fence >= 0) {
+		// The out-fence of the atomic commit is signaled when the new framebuffer is on the screen
+		struct pollfd fence_poll = {run->out_fence, POLLIN, 0};
+		_D_LOG_DEBUG("Polling out-fence for VSync ...");
+		const int result = poll(&fence_poll, 1, drm->timeout * 1000);
+		US_CLOSE_FD(run->out_fence);
+		if (result < 0) {
+			_D_LOG_PERROR("Can't poll out-fence for VSync");
+			return -1;
+		} else if (result == 0) {
+			_D_LOG_ERROR("Device timeout while waiting out-fence");
+			return -1;
+		}
+		run->has_vsync = true;
+		run->exposing_dma_fd = -1;
+		_D_LOG_DEBUG("Got VSync signal (out-fence)");
+		return 0;
+	}
+
 	struct timeval timeout = {.tv_sec = drm->timeout};
 	fd_set fds;
 	FD_ZERO(&fds);
@@ -308,7 +410,7 @@ static void _drm_vsync_callback(int fd, uint n_frame, uint sec, uint usec, void
 	_D_LOG_DEBUG("Got VSync signal");
 }
 
-int us_drm_expose_stub(us_drm_s *drm, us_drm_stub_e stub, const us_device_s *dev) {
+int us_drm_expose_stub(us_drm_s *drm, us_drm_stub_e stub) {
 	us_drm_runtime_s *const run = drm->run;
 
 	assert(run->fd >= 0);
@@ -324,14 +426,13 @@ int us_drm_expose_stub(us_drm_s *drm, us_drm_stub_e stub, const us_device_s *dev
 #	define DRAW_MSG(x_msg) us_frametext_draw(run->ft, (x_msg), run->mode.hdisplay, run->mode.vdisplay)
 	switch (stub) {
 		case US_DRM_STUB_BAD_RESOLUTION: {
-			assert(dev != NULL);
 			char msg[1024];
 			US_SNPRINTF(msg, 1023,
 				"=== PiKVM ==="
 				"\n \n< UNSUPPORTED RESOLUTION >"
 				"\n \n< %ux%up%.02f >"
 				"\n \nby this display",
-				dev->run->width, dev->run->height, dev->run->hz);
+				run->src_width, run->src_height, run->src_hz);
 			DRAW_MSG(msg);
 			break;
 		};
@@ -363,10 +464,7 @@ int us_drm_expose_stub(us_drm_s *drm, us_drm_stub_e stub, const us_device_s *dev
 	memcpy(buf->data, run->ft->frame->data, US_MIN(run->ft->frame->used, buf->allocated));
 
 	_D_LOG_DEBUG("Exposing STUB framebuffer n_buf=%u ...", run->stub_n_buf);
-	const int retval = drmModePageFlip(
-		run->fd, run->crtc_id, buf->id,
-		DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_PAGE_FLIP_ASYNC,
-		buf);
+	const int retval = _drm_flip(drm, buf);
 	if (retval < 0) {
 		_D_LOG_PERROR("Can't expose STUB framebuffer n_buf=%u ...", run->stub_n_buf);
 	}
@@ -382,6 +480,7 @@ int us_drm_expose_dma(us_drm_s *drm, const us_hw_buffer_s *hw) {
 
 	assert(run->fd >= 0);
 	assert(!run->opened_for_stub);
+	assert(!run->opened_for_conv);
 
 	switch (_drm_check_status(drm)) {
 		case 0: break;
@@ -393,10 +492,7 @@ int us_drm_expose_dma(us_drm_s *drm, const us_hw_buffer_s *hw) {
 	run->has_vsync = false;
 
 	_D_LOG_DEBUG("Exposing DMA framebuffer n_buf=%u ...", hw->buf.index);
-	const int retval = drmModePageFlip(
-		run->fd, run->crtc_id, buf->id,
-		DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_PAGE_FLIP_ASYNC,
-		buf);
+	const int retval = _drm_flip(drm, buf);
 	if (retval < 0) {
 		_D_LOG_PERROR("Can't expose DMA framebuffer n_buf=%u ...", run->stub_n_buf);
 	}
@@ -405,6 +501,44 @@ int us_drm_expose_dma(us_drm_s *drm, const us_hw_buffer_s *hw) {
 	return retval;
 }
 
+int us_drm_expose_conv(us_drm_s *drm, us_drm_buffer_s *buf) {
+	us_drm_runtime_s *const run = drm->run;
+
+	assert(run->fd >= 0);
+	assert(run->opened_for_conv);
+
+	switch (_drm_check_status(drm)) {
+		case 0: break;
+		case -2: return -2;
+		default: return -1;
+	}
+	_drm_ensure_dpms_power(drm, true);
+
+	run->has_vsync = false;
+
+	const uint n_buf = buf - run->bufs;
+	_D_LOG_DEBUG("Exposing CONV framebuffer n_buf=%u ...", n_buf);
+	const int retval = _drm_flip(drm, buf);
+	if (retval < 0) {
+		_D_LOG_PERROR("Can't expose CONV framebuffer n_buf=%u ...", n_buf);
+	}
+	_D_LOG_DEBUG("Exposed CONV framebuffer n_buf=%u", n_buf);
+	return retval;
+}
+
+static int _drm_flip(us_drm_s *drm, us_drm_buffer_s *buf) {
+	us_drm_runtime_s *const run = drm->run;
+	if (run->atomic) {
+		// Without the out-fence we will wait for the usual flip event
+		const u32 flags = DRM_MODE_ATOMIC_NONBLOCK | (run->props.crtc_out_fence_ptr > 0 ? 0 : DRM_MODE_PAGE_FLIP_EVENT);
+		return _drm_atomic_commit(drm, buf, flags);
+	}
+	return drmModePageFlip(
+		run->fd, run->crtc_id, buf->id,
+		DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_PAGE_FLIP_ASYNC,
+		buf);
+}
+
 static int _drm_check_status(us_drm_s *drm) {
 	us_drm_runtime_s *run = drm->run;
 
@@ -462,8 +596,8 @@ static void _drm_ensure_dpms_power(us_drm_s *drm, bool on) {
 static int _drm_init_buffers(us_drm_s *drm, const us_device_s *dev) {
 	us_drm_runtime_s *const run = drm->run;
 
-	const uint n_bufs = (dev == NULL ? 4 : dev->run->n_bufs);
-	const char *name = (dev == NULL ? "STUB" : "DMA");
+	const uint n_bufs = (dev == NULL ? (run->opened_for_conv ? US_DRM_CONV_BUFS : 4) : dev->run->n_bufs);
+	const char *name = (dev == NULL ? (run->opened_for_conv ? "CONV" : "STUB") : "DMA");
 
 	_D_LOG_DEBUG("Initializing %u %s buffers ...", n_bufs, name);
 
@@ -481,8 +615,8 @@ static int _drm_init_buffers(us_drm_s *drm, const us_device_s *dev) {
 
 		if (dev == NULL) {
 			struct drm_mode_create_dumb create = {
-				.width = run->mode.hdisplay,
-				.height = run->mode.vdisplay,
+				.width = run->fb_width,
+				.height = run->fb_height,
 				.bpp = 24,
 			};
 			if (drmIoctl(run->fd, DRM_IOCTL_MODE_CREATE_DUMB, &create) < 0) {
@@ -510,6 +644,7 @@ static int _drm_init_buffers(us_drm_s *drm, const us_device_s *dev) {
 
 			handles[0] = create.handle;
 			strides[0] = create.pitch;
+			buf->stride = create.pitch;
 
 		} else {
 			if (drmPrimeFDToHandle(run->fd, dev->run->hw_bufs[n_buf].dma_fd, &buf->handle) < 0) {
@@ -518,11 +653,12 @@ static int _drm_init_buffers(us_drm_s *drm, const us_device_s *dev) {
 			}
 			handles[0] = buf->handle;
 			strides[0] = dev->run->stride;
+			buf->stride = dev->run->stride;
 		}
 
 		if (drmModeAddFB2(
 			run->fd,
-			run->mode.hdisplay, run->mode.vdisplay, DRM_FORMAT_RGB888,
+			run->fb_width, run->fb_height, DRM_FORMAT_RGB888,
 			handles, strides, offsets, &buf->id, 0
 		)) {
 			_D_LOG_PERROR("Can't setup buffer=%u", n_buf);
@@ -613,6 +749,159 @@ unplugged:
 	return -2;
 }
 
+static int _drm_atomic_init(us_drm_s *drm) {
+	us_drm_runtime_s *const run = drm->run;
+
+	_D_LOG_DEBUG("Enabling atomic KMS ...");
+	if (
+		drmSetClientCap(run->fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1) < 0
+		|| drmSetClientCap(run->fd, DRM_CLIENT_CAP_ATOMIC, 1) < 0
+	) {
+		_D_LOG_PERROR("Can't enable atomic KMS");
+		return -1;
+	}
+
+	if ((run->plane_id = _find_primary_plane(run->fd, run->crtc_id)) == 0) {
+		_D_LOG_ERROR("Can't find primary plane for CRTC");
+		return -1;
+	}
+	_D_LOG_INFO("Using primary plane: id=%u", run->plane_id);
+
+	us_drm_props_s *const props = &run->props;
+#	define FIND_PROP(x_dest, x_obj_id, x_obj_type, x_name) { \
+			if ((props->x_dest = _find_property(run->fd, x_obj_id, x_obj_type, x_name, NULL)) == 0) { \
+				_D_LOG_ERROR("Can't find property " x_name); \
+				return -1; \
+			} \
+		}
+	FIND_PROP(conn_crtc_id,		run->conn_id,	DRM_MODE_OBJECT_CONNECTOR,	"CRTC_ID");
+	FIND_PROP(crtc_mode_id,		run->crtc_id,	DRM_MODE_OBJECT_CRTC,		"MODE_ID");
+	FIND_PROP(crtc_active,		run->crtc_id,	DRM_MODE_OBJECT_CRTC,		"ACTIVE");
+	FIND_PROP(plane_fb_id,		run->plane_id,	DRM_MODE_OBJECT_PLANE,		"FB_ID");
+	FIND_PROP(plane_crtc_id,	run->plane_id,	DRM_MODE_OBJECT_PLANE,		"CRTC_ID");
+	FIND_PROP(plane_src_x,		run->plane_id,	DRM_MODE_OBJECT_PLANE,		"SRC_X");
+	FIND_PROP(plane_src_y,		run->plane_id,	DRM_MODE_OBJECT_PLANE,		"SRC_Y");
+	FIND_PROP(plane_src_w,		run->plane_id,	DRM_MODE_OBJECT_PLANE,		"SRC_W");
+	FIND_PROP(plane_src_h,		run->plane_id,	DRM_MODE_OBJECT_PLANE,		"SRC_H");
+	FIND_PROP(plane_crtc_x,		run->plane_id,	DRM_MODE_OBJECT_PLANE,		"CRTC_X");
+	FIND_PROP(plane_crtc_y,		run->plane_id,	DRM_MODE_OBJECT_PLANE,		"CRTC_Y");
+	FIND_PROP(plane_crtc_w,		run->plane_id,	DRM_MODE_OBJECT_PLANE,		"CRTC_W");
+	FIND_PROP(plane_crtc_h,		run->plane_id,	DRM_MODE_OBJECT_PLANE,		"CRTC_H");
+#	undef FIND_PROP
+	props->crtc_out_fence_ptr = _find_property(run->fd, run->crtc_id, DRM_MODE_OBJECT_CRTC, "OUT_FENCE_PTR", NULL);
+	_D_LOG_INFO("Using out-fences: %s", (props->crtc_out_fence_ptr > 0 ? "yes" : "no"));
+
+	if (drmModeCreatePropertyBlob(run->fd, &run->mode, sizeof(run->mode), &run->mode_blob_id) < 0) {
+		_D_LOG_PERROR("Can't create mode blob");
+		run->mode_blob_id = 0;
+		return -1;
+	}
+	return 0;
+}
+
+static int _drm_atomic_modeset(us_drm_s *drm) {
+	us_drm_runtime_s *const run = drm->run;
+
+	const uint mode_width = run->mode.hdisplay;
+	const uint mode_height = run->mode.vdisplay;
+
+	// At first try to keep the aspect ratio, but some drivers (like vkms)
+	// can't position the primary plane, so try to stretch it to the full screen then.
+	// Returns -2 if the driver rejects all of the variants.
+	int probe = -1;
+	for (uint attempt = 0; attempt < 2; ++attempt) {
+		if (attempt == 0 && run->fb_width * mode_height != mode_width * run->fb_height) {
+			if (run->fb_width * mode_height > mode_width * run->fb_height) {
+				run->dest_width = mode_width;
+				run->dest_height = run->fb_height * mode_width / run->fb_width;
+			} else {
+				run->dest_width = run->fb_width * mode_height / run->fb_height;
+				run->dest_height = mode_height;
+			}
+		} else {
+			run->dest_width = mode_width;
+			run->dest_height = mode_height;
+		}
+		run->dest_x = (mode_width - run->dest_width) / 2;
+		run->dest_y = (mode_height - run->dest_height) / 2;
+
+		_D_LOG_DEBUG("Testing atomic modeset: %ux%u -> %ux%u+%u+%u ...",
+			run->fb_width, run->fb_height,
+			run->dest_width, run->dest_height, run->dest_x, run->dest_y);
+		probe = _drm_atomic_commit(drm, &run->bufs[0], DRM_MODE_ATOMIC_ALLOW_MODESET | DRM_MODE_ATOMIC_TEST_ONLY);
+		if (probe == 0) {
+			_D_LOG_DEBUG("Setting up CRTC (atomic) ...");
+			if (_drm_atomic_commit(drm, &run->bufs[0], DRM_MODE_ATOMIC_ALLOW_MODESET) < 0) {
+				_D_LOG_PERROR("Can't set CRTC (atomic)");
+				return -1;
+			}
+			_D_LOG_INFO("Using plane: %ux%u -> %ux%u+%u+%u",
+				run->fb_width, run->fb_height,
+				run->dest_width, run->dest_height, run->dest_x, run->dest_y);
+			return 0;
+		}
+		if (run->dest_width == mode_width && run->dest_height == mode_height) {
+			break; // Nothing to try anymore
+		}
+	}
+	if (probe == -1) {
+		return -1; // Can't build the request (it's logged by _drm_atomic_commit()) or -EPERM, both aren't fatal for atomic
+	}
+	errno = -probe; // drmModeAtomicCommit() returns -errno
+	if (probe == -EINVAL || probe == -ERANGE) {
+		_D_LOG_PERROR("The atomic modeset is rejected by the driver");
+		return -2;
+	}
+	_D_LOG_PERROR("Can't test the atomic modeset");
+	return -1;
+}
+
+static int _drm_atomic_commit(us_drm_s *drm, us_drm_buffer_s *buf, u32 flags) {
+	us_drm_runtime_s *const run = drm->run;
+	const us_drm_props_s *const props = &run->props;
+
+	drmModeAtomicReq *req = drmModeAtomicAlloc();
+	assert(req != NULL);
+
+	int retval = -1;
+
+#	define ADD_PROP(x_obj_id, x_prop_id, x_value) { \
+			if (drmModeAtomicAddProperty(req, x_obj_id, x_prop_id, x_value) < 0) { \
+				_D_LOG_PERROR("Can't add atomic property " #x_prop_id); \
+				goto done; \
+			} \
+		}
+	if (flags & DRM_MODE_ATOMIC_ALLOW_MODESET) {
+		ADD_PROP(run->conn_id,	props->conn_crtc_id,	run->crtc_id);
+		ADD_PROP(run->crtc_id,	props->crtc_mode_id,	run->mode_blob_id);
+		ADD_PROP(run->crtc_id,	props->crtc_active,		1);
+	}
+	ADD_PROP(run->plane_id,	props->plane_fb_id,		buf->id);
+	ADD_PROP(run->plane_id,	props->plane_crtc_id,	run->crtc_id);
+	ADD_PROP(run->plane_id,	props->plane_src_x,		0);
+	ADD_PROP(run->plane_id,	props->plane_src_y,		0);
+	ADD_PROP(run->plane_id,	props->plane_src_w,		(u64)run->fb_width << 16); // 16.16 fixed point
+	ADD_PROP(run->plane_id,	props->plane_src_h,		(u64)run->fb_height << 16);
+	ADD_PROP(run->plane_id,	props->plane_crtc_x,	run->dest_x);
+	ADD_PROP(run->plane_id,	props->plane_crtc_y,	run->dest_y);
+	ADD_PROP(run->plane_id,	props->plane_crtc_w,	run->dest_width);
+	ADD_PROP(run->plane_id,	props->plane_crtc_h,	run->dest_height);
+	if ((flags & DRM_MODE_ATOMIC_NONBLOCK) && props->crtc_out_fence_ptr > 0) {
+		US_CLOSE_FD(run->out_fence);
+		ADD_PROP(run->crtc_id,	props->crtc_out_fence_ptr,	(u64)(uintptr_t)&run->out_fence);
+	}
+#	undef ADD_PROP
+
+	retval = drmModeAtomicCommit(run->fd, req, flags, buf);
+	if (retval < 0) {
+		run->out_fence = -1; // Not filled on error
+	}
+
+done:
+	drmModeAtomicFree(req);
+	return retval;
+}
+
 static drmModeModeInfo *_find_best_mode(drmModeConnector *conn, uint width, uint height, float hz) {
 	drmModeModeInfo *best = NULL;
 	drmModeModeInfo *closest = NULL;
@@ -692,6 +981,72 @@ static u32 _find_crtc(int fd, drmModeRes *res, drmModeConnector *conn, u32 *take
 	return 0;
 }
 
+static u32 _find_primary_plane(int fd, u32 crtc_id) {
+	int crtc_index = -1;
+	drmModeRes *res = drmModeGetResources(fd);
+	if (res == NULL) {
+		_D_LOG_PERROR("Can't get resources info");
+		return 0;
+	}
+	for (int ci = 0; ci < res->count_crtcs; ++ci) {
+		if (res->crtcs[ci] == crtc_id) {
+			crtc_index = ci;
+			break;
+		}
+	}
+	drmModeFreeResources(res);
+	if (crtc_index < 0) {
+		return 0;
+	}
+
+	drmModePlaneRes *planes = drmModeGetPlaneResources(fd);
+	if (planes == NULL) {
+		_D_LOG_PERROR("Can't get planes info");
+		return 0;
+	}
+	u32 found = 0;
+	for (uint pi = 0; pi < planes->count_planes && found == 0; ++pi) {
+		drmModePlane *plane = drmModeGetPlane(fd, planes->planes[pi]);
+		if (plane == NULL) {
+			continue;
+		}
+		if (plane->possible_crtcs & (1 << crtc_index)) {
+			u64 type;
+			if (
+				_find_property(fd, plane->plane_id, DRM_MODE_OBJECT_PLANE, "type", &type) > 0
+				&& type == DRM_PLANE_TYPE_PRIMARY
+			) {
+				found = plane->plane_id;
+			}
+		}
+		drmModeFreePlane(plane);
+	}
+	drmModeFreePlaneResources(planes);
+	return found;
+}
+
+static u32 _find_property(int fd, u32 obj_id, u32 obj_type, const char *name, u64 *value) {
+	drmModeObjectProperties *props = drmModeObjectGetProperties(fd, obj_id, obj_type);
+	if (props == NULL) {
+		return 0;
+	}
+	u32 id = 0;
+	for (uint pi = 0; pi < props->count_props && id == 0; ++pi) {
+		drmModePropertyPtr prop = drmModeGetProperty(fd, props->props[pi]);
+		if (prop != NULL) {
+			if (!strcmp(prop->name, name)) {
+				id = prop->prop_id;
+				if (value != NULL) {
+					*value = props->prop_values[pi];
+				}
+			}
+			drmModeFreeProperty(prop);
+		}
+	}
+	drmModeFreeObjectProperties(props);
+	return id;
+}
+
 static const char *_connector_type_to_string(u32 type) {
 	switch (type) {
 #		define CASE_NAME(x_suffix, x_name) \
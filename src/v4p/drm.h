@@ -31,6 +31,9 @@
 #include "../libs/device.h"
 
 
+#define US_DRM_CONV_BUFS 2 // Double buffering for the CPU conversion
+
+
 typedef enum {
 	US_DRM_STUB_USER = 1,
 	US_DRM_STUB_BAD_RESOLUTION,
@@ -44,6 +47,7 @@ typedef struct {
 	u32		handle;
 	u8		*data;
 	uz		allocated;
+	uint	stride;
 	bool	dumb_created;
 	bool	fb_added;
 	struct {
@@ -52,6 +56,23 @@ typedef struct {
 	} ctx;
 } us_drm_buffer_s;
 
+typedef struct {
+	u32	conn_crtc_id;
+	u32	crtc_mode_id;
+	u32	crtc_active;
+	u32	crtc_out_fence_ptr; // Optional
+	u32	plane_fb_id;
+	u32	plane_crtc_id;
+	u32	plane_src_x;
+	u32	plane_src_y;
+	u32	plane_src_w;
+	u32	plane_src_h;
+	u32	plane_crtc_x;
+	u32	plane_crtc_y;
+	u32	plane_crtc_w;
+	u32	plane_crtc_h;
+} us_drm_props_s;
+
 typedef struct {
 	int				status_fd;
 	int				fd;
@@ -64,17 +85,36 @@ typedef struct {
 	drmModeCrtc		*saved_crtc;
 	int				dpms_state;
 	bool			opened_for_stub;
+	bool			opened_for_conv;
+	uint			src_width;
+	uint			src_height;
+	uint			src_format;
+	float			src_hz;
 	bool			has_vsync;
 	int				exposing_dma_fd;
 	uint			stub_n_buf;
 	bool			unplugged_reported;
 	us_frametext_s	*ft;
+
+	bool			atomic;
+	bool			atomic_disabled;
+	us_drm_props_s	props;
+	u32				plane_id;
+	u32				mode_blob_id;
+	int				out_fence;
+	uint			fb_width;
+	uint			fb_height;
+	uint			dest_x;
+	uint			dest_y;
+	uint			dest_width;
+	uint			dest_height;
 } us_drm_runtime_s;
 
 typedef struct {
 	char	*path;
 	char	*port;
 	uint	timeout;
+	bool	atomic;
 
 	us_drm_runtime_s *run;
 } us_drm_s;
@@ -84,9 +124,11 @@ us_drm_s *us_drm_init(void);
 void us_drm_destroy(us_drm_s *drm);
 
 int us_drm_open(us_drm_s *drm, const us_device_s *dev);
+int us_drm_open_frame(us_drm_s *drm, const us_frame_s *frame);
 void us_drm_close(us_drm_s *drm);
 
 int us_drm_dpms_power_off(us_drm_s *drm);
 int us_drm_wait_for_vsync(us_drm_s *drm);
-int us_drm_expose_stub(us_drm_s *drm, us_drm_stub_e stub, const us_device_s *dev);
+int us_drm_expose_stub(us_drm_s *drm, us_drm_stub_e stub);
 int us_drm_expose_dma(us_drm_s *drm, const us_hw_buffer_s *hw);
+int us_drm_expose_conv(us_drm_s *drm, us_drm_buffer_s *buf);
@@ -27,6 +27,8 @@
 #include <unistd.h>
 #include <getopt.h>
 #include <errno.h>
+#include <libgen.h>
+#include <poll.h>
 #include <assert.h>
 
 #include <pthread.h>
@@ -34,25 +36,36 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/stat.h>
+#include <sys/inotify.h>
 
 #include "../libs/types.h"
 #include "../libs/const.h"
 #include "../libs/tools.h"
+#include "../libs/threading.h"
 #include "../libs/logging.h"
+#include "../libs/queue.h"
 #include "../libs/device.h"
+#include "../libs/frame.h"
+#include "../libs/memsink.h"
 #include "../libs/signal.h"
 #include "../libs/options.h"
 
 #include "drm.h"
+#include "conv.h"
 
 
 enum _OPT_VALUES {
 	_O_UNIX_FOLLOW = 'f',
+	_O_DEVICE = 'd',
+	_O_DRM_PORT = 'p',
 
 	_O_HELP = 'h',
 	_O_VERSION = 'v',
 
-	_O_LOG_LEVEL = 10000,
+	_O_DRM_LEGACY = 10000,
+	_O_RAW_SINK,
+
+	_O_LOG_LEVEL,
 	_O_PERF,
 	_O_VERBOSE,
 	_O_DEBUG,
@@ -62,6 +75,10 @@ enum _OPT_VALUES {
 
 static const struct option _LONG_OPTS[] = {
 	{"unix-follow",			required_argument,	NULL,	_O_UNIX_FOLLOW},
+	{"device",				required_argument,	NULL,	_O_DEVICE},
+	{"drm-port",			required_argument,	NULL,	_O_DRM_PORT},
+	{"drm-legacy",			no_argument,		NULL,	_O_DRM_LEGACY},
+	{"raw-sink",			required_argument,	NULL,	_O_RAW_SINK},
 
 	{"log-level",			required_argument,	NULL,	_O_LOG_LEVEL},
 	{"perf",				no_argument,		NULL,	_O_PERF},
@@ -77,14 +94,38 @@ static const struct option _LONG_OPTS[] = {
 };
 
 
+typedef struct {
+	us_device_s		*dev; // The capture device
+	us_memsink_s	*sink; // Or the RAW sink of the running uStreamer
+	us_frame_s		*frame; // For the sink only
+	us_drm_s		*drm;
+	us_conv_s		*conv; // For the CPU conversion only
+	us_queue_s		*conv_free; // Dumb buffers which are not used by the flip
+	us_queue_s		*mailbox; // The latest captured frame or converted buffer only
+	pthread_mutex_t	release_mutex;
+	pthread_t		tid;
+	atomic_bool		stop;
+} _capture_context_s;
+
+
 volatile atomic_bool _g_stop = false;
 atomic_bool _g_ustreamer_online = false;
+us_queue_s *_g_follower_events = NULL; // Wakes up _slowdown() on the online state changes
 
 
 static void _signal_handler(int signum);
 
-static void _main_loop();
+static void _main_loop(const char *dev_path, const char *drm_port, bool drm_legacy, const char *raw_sink);
+static _capture_context_s *_capture_init(us_device_s *dev, us_memsink_s *sink, us_drm_s *drm);
+static void _capture_destroy(_capture_context_s *ctx);
+static void *_capture_thread(void *v_ctx);
+static int _capture_grab(_capture_context_s *ctx, void **item);
+static us_drm_buffer_s *_capture_convert(_capture_context_s *ctx, const us_frame_s *frame);
+static int _capture_release(_capture_context_s *ctx, void *item);
+static int _capture_release_hw(_capture_context_s *ctx, us_hw_buffer_s *hw);
 static void *_follower_thread(void *v_unix_follow);
+static int _follower_connect(const char *path);
+static bool _follower_read_inotify(int fd, const char *name);
 static void _slowdown(void);
 
 static void _help(FILE *fp);
@@ -95,6 +136,10 @@ int main(int argc, char *argv[]) {
 	US_THREAD_RENAME("main");
 
 	char *unix_follow = NULL;
+	const char *dev_path = "/dev/kvmd-video";
+	const char *drm_port = "HDMI-A-2";
+	bool drm_legacy = false;
+	const char *raw_sink = NULL;
 
 #	define OPT_SET(_dest, _value) { \
 			_dest = _value; \
@@ -117,6 +162,10 @@ int main(int argc, char *argv[]) {
 	for (int ch; (ch = getopt_long(argc, argv, short_opts, _LONG_OPTS, NULL)) >= 0;) {
 		switch (ch) {
 			case _O_UNIX_FOLLOW:	OPT_SET(unix_follow, optarg);
+			case _O_DEVICE:			OPT_SET(dev_path, optarg);
+			case _O_DRM_PORT:		OPT_SET(drm_port, optarg);
+			case _O_DRM_LEGACY:		OPT_SET(drm_legacy, true);
+			case _O_RAW_SINK:		OPT_SET(raw_sink, optarg);
 
 			case _O_LOG_LEVEL:			OPT_NUMBER("--log-level", us_g_log_level, US_LOG_LEVEL_INFO, US_LOG_LEVEL_DEBUG, 0);
 			case _O_PERF:				OPT_SET(us_g_log_level, US_LOG_LEVEL_PERF);
@@ -138,14 +187,16 @@ int main(int argc, char *argv[]) {
 
 	us_install_signals_handler(_signal_handler, false);
 
+	_g_follower_events = us_queue_init(1);
 	pthread_t follower_tid;
 	if (unix_follow != NULL) {
 		US_THREAD_CREATE(follower_tid, _follower_thread, unix_follow);
 	}
-	_main_loop();
+	_main_loop(dev_path, drm_port, drm_legacy, raw_sink);
 	if (unix_follow != NULL) {
 		US_THREAD_JOIN(follower_tid);
 	}
+	us_queue_destroy(_g_follower_events);
 
 	US_LOGGING_DESTROY;
 	return 0;
@@ -158,22 +209,26 @@ static void _signal_handler(int signum) {
 	atomic_store(&_g_stop, true);
 }
 
-static void _main_loop(void) {
+static void _main_loop(const char *dev_path, const char *drm_port, bool drm_legacy, const char *raw_sink) {
 	us_drm_s *drm = us_drm_init();
-	drm->port = "HDMI-A-2";
+	drm->port = (char*)drm_port;
+	drm->atomic = !drm_legacy;
 
 	us_device_s *dev = us_device_init();
-	dev->path = "/dev/kvmd-video";
+	dev->path = (char*)dev_path;
 	dev->n_bufs = 6;
 	dev->format = V4L2_PIX_FMT_RGB24;
 	dev->dv_timings = true;
 	dev->persistent = true;
-	dev->dma_export = true;
-	dev->dma_required = true;
+	dev->dma_export = true; // Without DMA the frames will be converted to dumb buffers
+
+	us_frame_s *sink_frame = us_frame_init();
 
 	int once = 0;
 	ldf blank_at_ts = 0;
 	int drm_opened = -1;
+	us_memsink_s *sink = NULL;
+	_capture_context_s *capture = NULL;
 	while (!atomic_load(&_g_stop)) {
 #		define CHECK(x_arg) if ((x_arg) < 0) { goto close; }
 
@@ -185,60 +240,104 @@ static void _main_loop(void) {
 
 		if (atomic_load(&_g_ustreamer_online)) {
 			blank_at_ts = 0;
-			US_ONCE({ US_LOG_INFO("DRM: Online stream is active, stopping capture ..."); });
-			CHECK(us_drm_wait_for_vsync(drm));
-			CHECK(us_drm_expose_stub(drm, US_DRM_STUB_BUSY, NULL));
-			_slowdown();
-			continue;
-		}
-
-		if (us_device_open(dev) < 0) {
-			ldf now_ts = us_get_now_monotonic();
-			if (blank_at_ts == 0) {
-				blank_at_ts = now_ts + 5;
+			bool sink_ready = false;
+			if (raw_sink != NULL) {
+				// The device is busy, so show the frames which uStreamer puts to its RAW sink
+				if (sink == NULL) {
+					sink = us_memsink_init("RAW", raw_sink, false, 0, false, 0, 1);
+				}
+				if (sink != NULL) {
+					switch (us_memsink_client_get(sink, sink_frame, NULL, false)) {
+						case 0: sink_ready = true; break;
+						case -2: break; // Waiting for the first frame
+						default: US_DELETE(sink, us_memsink_destroy);
+					}
+				}
 			}
-			if (now_ts <= blank_at_ts) {
+			if (!sink_ready) {
+				US_ONCE({ US_LOG_INFO("DRM: Online stream is active, stopping capture ..."); });
 				CHECK(us_drm_wait_for_vsync(drm));
-				CHECK(us_drm_expose_stub(drm, US_DRM_STUB_NO_SIGNAL, NULL));
-			} else {
-				US_ONCE({ US_LOG_INFO("DRM: Turning off the display by timeout ..."); });
-				CHECK(us_drm_dpms_power_off(drm));
+				CHECK(us_drm_expose_stub(drm, US_DRM_STUB_BUSY));
+				if (sink == NULL) {
+					_slowdown();
+				}
+				continue;
 			}
-			_slowdown();
-			continue;
+
+			once = 0;
+			US_LOG_INFO("DRM: Online stream is active, showing its RAW sink ...");
+			us_drm_close(drm);
+			CHECK(drm_opened = us_drm_open_frame(drm, sink_frame));
+
+		} else {
+			if (us_device_open(dev) < 0) {
+				ldf now_ts = us_get_now_monotonic();
+				if (blank_at_ts == 0) {
+					blank_at_ts = now_ts + 5;
+				}
+				if (now_ts <= blank_at_ts) {
+					CHECK(us_drm_wait_for_vsync(drm));
+					CHECK(us_drm_expose_stub(drm, US_DRM_STUB_NO_SIGNAL));
+				} else {
+					US_ONCE({ US_LOG_INFO("DRM: Turning off the display by timeout ..."); });
+					CHECK(us_drm_dpms_power_off(drm));
+				}
+				_slowdown();
+				continue;
+			}
+
+			once = 0;
+			blank_at_ts = 0;
+			us_drm_close(drm);
+			CHECK(drm_opened = us_drm_open(drm, dev));
 		}
 
-		once = 0;
-		blank_at_ts = 0;
-		us_drm_close(drm);
-		CHECK(drm_opened = us_drm_open(drm, dev));
+		// The capture thread dequeues frames as fast as they come and keeps
+		// only the newest one in the mailbox, so the flip is never late
+		// for more than one frame and the capture is not throttled by VSync.
+		// If the format can't be scanned out, the same thread converts
+		// the frames to the dumb buffers, so the flip never waits for it.
+		capture = _capture_init((sink == NULL ? dev : NULL), sink, drm);
 
-		us_hw_buffer_s *prev_hw = NULL;
+		void *prev_item = NULL; // On the screen before the last flip
+		void *flip_item = NULL; // The last flipped
 		while (!atomic_load(&_g_stop)) {
-			if (atomic_load(&_g_ustreamer_online)) {
+			if (
+				atomic_load(&_g_ustreamer_online) != (capture->sink != NULL)
+				|| atomic_load(&capture->stop)
+			) {
 				goto close;
 			}
 
 			CHECK(us_drm_wait_for_vsync(drm));
 
-			if (prev_hw != NULL) {
-				CHECK(us_device_release_buffer(dev, prev_hw));
-				prev_hw = NULL;
+			// The flip is done, so the previous buffer is not scanned out anymore.
+			// Without a new flip the last one is still on the screen and must be kept.
+			if (flip_item != NULL) {
+				if (prev_item != NULL) {
+					CHECK(_capture_release(capture, prev_item));
+				}
+				prev_item = flip_item;
+				flip_item = NULL;
 			}
 
-			us_hw_buffer_s *hw;
-			switch (us_device_grab_buffer(dev, &hw)) {
-				case -2: continue; // Broken frame
-				case -1: goto close; // Any error
-				default: break; // Grabbed on >= 0
+			void *item;
+			if (us_queue_get(capture->mailbox, &item, 0.1) < 0) {
+				continue; // No new frames
 			}
 
 			if (drm_opened == 0) {
-				CHECK(us_drm_expose_dma(drm, hw));
-				prev_hw = hw;
+				if ((capture->conv != NULL
+					? us_drm_expose_conv(drm, item)
+					: us_drm_expose_dma(drm, item)
+				) < 0) {
+					_capture_release(capture, item);
+					goto close;
+				}
+				flip_item = item;
 			} else {
-				CHECK(us_drm_expose_stub(drm, drm_opened, dev));
-				CHECK(us_device_release_buffer(dev, hw));
+				CHECK(us_drm_expose_stub(drm, drm_opened));
+				CHECK(_capture_release(capture, item));
 			}
 
 			if (drm_opened > 0) {
@@ -247,9 +346,11 @@ static void _main_loop(void) {
 		}
 
 	close:
+		US_DELETE(capture, _capture_destroy);
 		us_drm_close(drm);
 		drm_opened = -1;
 
+		US_DELETE(sink, us_memsink_destroy);
 		us_device_close(dev);
 
 		_slowdown();
@@ -257,35 +358,270 @@ static void _main_loop(void) {
 #		undef CHECK
 	}
 
+	us_frame_destroy(sink_frame);
 	us_device_destroy(dev);
 	us_drm_destroy(drm);
 }
 
+static _capture_context_s *_capture_init(us_device_s *dev, us_memsink_s *sink, us_drm_s *drm) {
+	assert((dev == NULL) != (sink == NULL));
+	_capture_context_s *ctx;
+	US_CALLOC(ctx, 1);
+	ctx->dev = dev;
+	ctx->sink = sink;
+	if (sink != NULL) {
+		ctx->frame = us_frame_init();
+	}
+	ctx->drm = drm;
+	if (drm->run->opened_for_conv) {
+		ctx->conv = us_conv_init();
+		ctx->conv_free = us_queue_init(drm->run->n_bufs);
+		for (uint index = 0; index < drm->run->n_bufs; ++index) {
+			assert(!us_queue_put(ctx->conv_free, &drm->run->bufs[index], 0));
+		}
+	}
+	ctx->mailbox = us_queue_init(1);
+	US_MUTEX_INIT(ctx->release_mutex);
+	atomic_init(&ctx->stop, false);
+	US_THREAD_CREATE(ctx->tid, _capture_thread, ctx);
+	return ctx;
+}
+
+static void _capture_destroy(_capture_context_s *ctx) {
+	// The buffers are not released here because the device will be closed anyway
+	atomic_store(&ctx->stop, true);
+	US_THREAD_JOIN(ctx->tid);
+	us_queue_destroy(ctx->mailbox);
+	if (ctx->conv != NULL) {
+		us_queue_destroy(ctx->conv_free);
+		us_conv_destroy(ctx->conv);
+	}
+	US_DELETE(ctx->frame, us_frame_destroy);
+	US_MUTEX_DESTROY(ctx->release_mutex);
+	free(ctx);
+}
+
+static void *_capture_thread(void *v_ctx) {
+	US_THREAD_SETTLE("capture");
+	_capture_context_s *const ctx = v_ctx;
+
+	while (!atomic_load(&ctx->stop) && !atomic_load(&_g_stop)) {
+		void *item;
+		switch (_capture_grab(ctx, &item)) {
+			case -2: continue; // Broken or not converted frame
+			case -1: goto done; // Any error
+			default: break;
+		}
+
+		// Replace the frame which was not taken by the flip yet.
+		// We are the only producer, so the put can't fail after that.
+		void *old_item;
+		if (us_queue_get(ctx->mailbox, &old_item, 0) == 0) {
+			US_LOG_DEBUG("CAPTURE: Dropped not displayed frame");
+			if (_capture_release(ctx, old_item) < 0) {
+				_capture_release(ctx, item);
+				goto done;
+			}
+		}
+		assert(!us_queue_put(ctx->mailbox, item, 0));
+	}
+
+done:
+	atomic_store(&ctx->stop, true);
+	return NULL;
+}
+
+static int _capture_grab(_capture_context_s *ctx, void **item) {
+	if (ctx->sink != NULL) {
+		switch (us_memsink_client_get(ctx->sink, ctx->frame, NULL, false)) {
+			case 0: break;
+			case -2: return (us_memsink_client_wait(ctx->sink) < 0 ? -1 : -2); // No new frames
+			default: return -1;
+		}
+		const us_drm_runtime_s *const drm_run = ctx->drm->run;
+		if (
+			ctx->frame->width != drm_run->src_width
+			|| ctx->frame->height != drm_run->src_height
+			|| ctx->frame->format != drm_run->src_format
+		) {
+			US_LOG_INFO("CAPTURE: RAW sink frame geometry has changed");
+			return -1; // DRM will be reopened
+		}
+		if (ctx->conv == NULL) {
+			*item = ctx->frame; // For the stub, nothing to release
+			return 0;
+		}
+		return ((*item = _capture_convert(ctx, ctx->frame)) == NULL ? -2 : 0);
+	}
+
+	us_hw_buffer_s *hw;
+	switch (us_device_grab_buffer(ctx->dev, &hw)) {
+		case -2: return -2; // Broken frame
+		case -1: return -1; // Any error
+		default: break; // Grabbed on >= 0
+	}
+	if (ctx->conv == NULL) {
+		*item = hw;
+		return 0;
+	}
+	// The capture buffer is not needed after the conversion
+	us_drm_buffer_s *const buf = _capture_convert(ctx, &hw->raw);
+	if (_capture_release_hw(ctx, hw) < 0) {
+		if (buf != NULL) {
+			assert(!us_queue_put(ctx->conv_free, buf, 0));
+		}
+		return -1;
+	}
+	return ((*item = buf) == NULL ? -2 : 0);
+}
+
+static us_drm_buffer_s *_capture_convert(_capture_context_s *ctx, const us_frame_s *frame) {
+	// Take a free buffer or the converted one which is not taken by the flip yet.
+	// Both can be busy only until the nearest VSync when the flipped buffer will be released.
+	us_drm_buffer_s *buf;
+	while (
+		us_queue_get(ctx->conv_free, (void**)&buf, 0) < 0
+		&& us_queue_get(ctx->mailbox, (void**)&buf, 0) < 0
+		&& us_queue_get(ctx->conv_free, (void**)&buf, 0.1) < 0
+	) {
+		if (atomic_load(&ctx->stop) || atomic_load(&_g_stop)) {
+			return NULL;
+		}
+	}
+
+	const us_drm_runtime_s *const drm_run = ctx->drm->run;
+	const ldf begin_ts = us_get_now_monotonic();
+	if (us_conv_to_rgb24(ctx->conv, frame, buf->data, drm_run->fb_width, drm_run->fb_height, buf->stride) < 0) {
+		assert(!us_queue_put(ctx->conv_free, buf, 0));
+		return NULL;
+	}
+	US_LOG_PERF("CAPTURE: Converted frame to RGB24 in %.3Lf", us_get_now_monotonic() - begin_ts);
+	return buf;
+}
+
+static int _capture_release(_capture_context_s *ctx, void *item) {
+	if (ctx->conv != NULL) {
+		// The dumb buffer is returned to the converter
+		assert(!us_queue_put(ctx->conv_free, item, 0));
+		return 0;
+	} else if (ctx->sink != NULL) {
+		return 0; // The sink frame is reused
+	}
+	return _capture_release_hw(ctx, item);
+}
+
+static int _capture_release_hw(_capture_context_s *ctx, us_hw_buffer_s *hw) {
+	US_MUTEX_LOCK(ctx->release_mutex);
+	const int retval = us_device_release_buffer(ctx->dev, hw);
+	US_MUTEX_UNLOCK(ctx->release_mutex);
+	return retval;
+}
+
 static void *_follower_thread(void *v_unix_follow) {
 	US_THREAD_SETTLE("follower");
 	const char *path = v_unix_follow;
 	assert(path != NULL);
 
-	while (!atomic_load(&_g_stop)) {
-		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
-		assert(fd >= 0);
+	// The socket directory is watched to catch the socket creation immediately,
+	// and the persistent connection is hung up when uStreamer goes away.
+	// The timeout is just a fallback, so there is no periodic probing.
+	char *const dir_buf = us_strdup(path);
+	char *const name_buf = us_strdup(path);
+	const char *const dir_path = dirname(dir_buf);
+	const char *const name = basename(name_buf);
+
+	int inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotify_fd < 0) {
+		US_LOG_PERROR("FOLLOWER: Can't create inotify");
+	} else if (inotify_add_watch(inotify_fd, dir_path, IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM | IN_ATTRIB) < 0) {
+		US_LOG_PERROR("FOLLOWER: Can't watch directory %s", dir_path);
+		US_CLOSE_FD(inotify_fd);
+	}
 
-		struct sockaddr_un addr = {0};
-		strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
-		addr.sun_family = AF_UNIX;
+	int conn_fd = -1;
+	ldf retry_until_ts = 0;
+	while (!atomic_load(&_g_stop)) {
+		if (conn_fd < 0) {
+			conn_fd = _follower_connect(path);
+		}
+		const bool online = (conn_fd >= 0);
+		if (atomic_exchange(&_g_ustreamer_online, online) != online) {
+			US_LOG_INFO("FOLLOWER: uStreamer is %s", (online ? "online" : "offline"));
+			us_queue_put(_g_follower_events, NULL, 0); // Skipped if it's already notified
+		}
 
-		const bool online = !connect(fd, (struct sockaddr*)&addr, sizeof(addr));
-		atomic_store(&_g_ustreamer_online, online);
-		US_CLOSE_FD(fd); // cppcheck-suppress unreadVariable
+		// The socket file may be created before listen(), so retry for a while after the event
+		const bool retry = (!online && us_get_now_monotonic() < retry_until_ts);
+
+		struct pollfd fds[2] = {
+			{.fd = inotify_fd, .events = POLLIN},
+			{.fd = conn_fd, .events = POLLRDHUP}, // Negative fds are ignored
+		};
+		if (poll(fds, 2, (retry ? 10 : 1000)) < 0) {
+			if (errno != EINTR) {
+				US_LOG_PERROR("FOLLOWER: Can't poll events");
+				usleep(1000 * 1000);
+			}
+			continue;
+		}
 
-		usleep(200 * 1000);
+		if (fds[0].revents & POLLIN) {
+			if (_follower_read_inotify(inotify_fd, name)) {
+				retry_until_ts = us_get_now_monotonic() + 1;
+				if (online) {
+					US_CLOSE_FD(conn_fd); // Check that it's still the same uStreamer
+				}
+			}
+		}
+		if (fds[1].revents) {
+			// The connection is closed on exit of uStreamer or by its idle timeout,
+			// so just try to reconnect on the next iteration.
+			US_CLOSE_FD(conn_fd);
+		}
 	}
+
+	US_CLOSE_FD(conn_fd);
+	US_CLOSE_FD(inotify_fd);
+	free(name_buf);
+	free(dir_buf);
 	return NULL;
 }
 
+static int _follower_connect(const char *path) {
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	assert(fd >= 0);
+
+	struct sockaddr_un addr = {0};
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	addr.sun_family = AF_UNIX;
+
+	if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		US_CLOSE_FD(fd);
+	}
+	return fd;
+}
+
+static bool _follower_read_inotify(int fd, const char *name) {
+	bool found = false;
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		for (char *ptr = buf; ptr < buf + len;) {
+			const struct inotify_event *const event = (const struct inotify_event*)ptr;
+			if (event->len > 0 && !strcmp(event->name, name)) {
+				found = true;
+			}
+			ptr += sizeof(struct inotify_event) + event->len;
+		}
+	}
+	return found;
+}
+
 static void _slowdown(void) {
+	// Returns immediately if the online state of uStreamer has been changed
 	if (!atomic_load(&_g_stop)) {
-		usleep(500 * 1000);
+		void *item;
+		us_queue_get(_g_follower_events, &item, 0.5);
 	}
 }
 
@@ -300,7 +636,16 @@ static void _help(FILE *fp) {
 	SAY("    ustreamer-v4p\n");
 	SAY("Passthrough options:");
 	SAY("════════════════════");
-	SAY("    -f|--unix-follow <path>  ──────── Pause the process if the specified socked exists.\n");
+	SAY("    -f|--unix-follow <path>  ──────── Pause the process if the specified socked exists.");
+	SAY("                                      The socket directory is watched using inotify.\n");
+	SAY("    -d|--device <path>  ───────────── Path to V4L2 capture device. Default: /dev/kvmd-video.\n");
+	SAY("    -p|--drm-port <name>  ─────────── DRM connector to show the video on. Default: HDMI-A-2.\n");
+	SAY("    --raw-sink <name>  ────────────── Show the frames from the RAW sink of uStreamer instead of the STUB");
+	SAY("                                      while uStreamer is online (see --unix-follow). uStreamer must be run");
+	SAY("                                      with the same --raw-sink. Default: disabled.\n");
+	SAY("    --drm-legacy  ─────────────────── Don't try atomic KMS, use legacy modesetting and page flips.");
+	SAY("                                      Without it, the plane scaling is used for non-native resolutions");
+	SAY("                                      and the out-fences are used for VSync. Default: disabled.\n");
 	SAY("Logging options:");
 	SAY("════════════════");
 	SAY("    --log-level <N>  ──── Verbosity level of messages from 0 (info) to 3 (debug).");